@@ -39,8 +39,10 @@ module Arbiter #(
     input  logic [1:0]            m_axi_rresp,
     input  logic                  m_axi_rlast,
     input  logic                  m_axi_rvalid,
-    output logic                  m_axi_rready
+    output logic                  m_axi_rready,
 
+    output logic                  waiting_read, // REFILL with no beat this cycle
+    output logic                  conflict      // one cache's request waits for the other's
 );
 
     // FSM States
@@ -63,6 +65,10 @@ module Arbiter #(
     assign m_axi_arcache  = 4'b0011;
     assign m_axi_arprot   = 3'b000;
 
+    assign waiting_read   = current_state == REFILL && !m_axi_rvalid;
+    assign conflict       = current_state == IDLE ? icache_arvalid && dcache_arvalid
+                                                  : (servicing_icache ? dcache_arvalid : icache_arvalid);
+
     always_comb begin
         next_state = current_state;
         case (current_state)
@@ -0,0 +1,189 @@
+// Runs every program of a manifest through Vtop, several at a time, and summarizes the results.
+//
+// Manifest lines are "[VAR=value ...] program [args ...]"; blank lines and lines starting
+// with # are skipped.  Each instance runs in the Vtop directory with BENCH=y, its own
+// DRAMSIM_RESULTS directory (dramsim2/results/batch-<n>) and its stdout/stderr in
+// <outdir>/<n>-<program>.{out,err}.  Every Vtop already has a private /vtop-system-<pid> RAM.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <assert.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+using namespace std;
+
+struct Job {
+    vector<string> env, argv;
+    string name;
+    pid_t pid;
+    int status;
+    double secs;
+    chrono::steady_clock::time_point start;
+    string cycles, insts;
+};
+
+static void usage(const char* self) {
+    cerr << "usage: " << self << " [-j jobs] [-o outdir] [-v vtop] manifest" << endl;
+    exit(2);
+}
+
+static vector<Job> read_manifest(const char* filename) {
+    vector<Job> jobs;
+    ifstream manifest(filename);
+    if (!manifest) {
+        cerr << "Cannot open manifest " << filename << endl;
+        exit(2);
+    }
+    string line;
+    while(getline(manifest, line)) {
+        istringstream words(line);
+        string word;
+        Job job;
+        while(words >> word) {
+            if (job.argv.empty() && word[0] == '#') break;
+            if (job.argv.empty() && word.find('=') != string::npos) job.env.push_back(word);
+            else job.argv.push_back(word);
+        }
+        if (job.argv.empty()) continue;
+        string base = job.argv[0].substr(job.argv[0].rfind('/') + 1);
+        job.name = to_string(jobs.size()) + "-" + base;
+        jobs.push_back(job);
+    }
+    return jobs;
+}
+
+static void start(Job& job, const string& vtop, const string& outdir, int n) {
+    job.start = chrono::steady_clock::now();
+    job.pid = fork();
+    assert(job.pid != -1);
+    if (job.pid) return;
+
+    // Vtop finds its DRAMSim2 configuration relative to its own directory
+    string dir = vtop.substr(0, vtop.rfind('/'));
+    int out = open((outdir + "/" + job.name + ".out").c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    int err = open((outdir + "/" + job.name + ".err").c_str(), O_WRONLY|O_CREAT|O_TRUNC, 0644);
+    int null = open("/dev/null", O_RDONLY);
+    if (out == -1 || err == -1 || null == -1 || chdir(dir.c_str())) _exit(127);
+    dup2(null, 0);
+    dup2(out, 1);
+    dup2(err, 2);
+    setenv("BENCH", "y", 1);
+    setenv("DRAMSIM_RESULTS", ("batch-" + to_string(n)).c_str(), 1);
+    for(auto& e : job.env) putenv(strdup(e.c_str()));
+    vector<char*> argv;
+    argv.push_back((char*)vtop.c_str());
+    for(auto& a : job.argv) argv.push_back((char*)a.c_str());
+    argv.push_back(NULL);
+    execv(vtop.c_str(), argv.data());
+    _exit(127);
+}
+
+// pick the cycle and instruction counts out of the BENCH=y report
+static void collect(Job& job, const string& outdir) {
+    ifstream err(outdir + "/" + job.name + ".err");
+    string line;
+    while(getline(err, line)) {
+        istringstream words(line);
+        string w1, w2, n;
+        words >> w1 >> w2 >> n;
+        if (w1 != "==") continue;
+        if (w2 == "Simulated") job.cycles = n;
+        if (w2 == "Retired") job.insts = n;
+    }
+}
+
+static string status(const Job& job) {
+    if (WIFEXITED(job.status)) return "exit " + to_string(WEXITSTATUS(job.status));
+    if (WIFSIGNALED(job.status)) return string("killed by ") + strsignal(WTERMSIG(job.status));
+    return "?";
+}
+
+int main(int argc, char* argv[]) {
+    int max_jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    string outdir = "batch-results";
+    string vtop = "obj_dir/Vtop";
+    int opt;
+    while((opt = getopt(argc, argv, "j:o:v:")) != -1) {
+        switch(opt) {
+            case 'j': max_jobs = atoi(optarg); break;
+            case 'o': outdir = optarg; break;
+            case 'v': vtop = optarg; break;
+            default: usage(argv[0]);
+        }
+    }
+    if (optind != argc-1 || max_jobs < 1) usage(argv[0]);
+
+    vector<Job> jobs = read_manifest(argv[optind]);
+    char path[PATH_MAX];
+    if (!realpath(vtop.c_str(), path)) {
+        cerr << "Cannot find " << vtop << ", build it first" << endl;
+        return 2;
+    }
+    vtop = path;
+    mkdir(outdir.c_str(), 0755);
+    if (!realpath(outdir.c_str(), path)) {
+        cerr << "Cannot create " << outdir << endl;
+        return 2;
+    }
+    outdir = path;
+
+    chrono::steady_clock::time_point batch_start = chrono::steady_clock::now();
+    map<pid_t, size_t> running;
+    size_t next = 0;
+    while(next < jobs.size() || !running.empty()) {
+        if (next < jobs.size() && (int)running.size() < max_jobs) {
+            start(jobs[next], vtop, outdir, next);
+            running[jobs[next].pid] = next;
+            ++next;
+            continue;
+        }
+        int status;
+        pid_t pid = wait(&status);
+        if (pid == -1) break;
+        auto r = running.find(pid);
+        if (r == running.end()) continue;
+        Job& job = jobs[r->second];
+        job.status = status;
+        job.secs = chrono::duration<double>(chrono::steady_clock::now() - job.start).count();
+        collect(job, outdir);
+        cerr << "[" << running.size() - 1 + (jobs.size() - next) << " left] " << job.name << ": " << ::status(job) << endl;
+        running.erase(r);
+    }
+    double wall = chrono::duration<double>(chrono::steady_clock::now() - batch_start).count();
+
+    // one summary, with each program's stdout
+    ofstream summary(outdir + "/summary.txt");
+    double total = 0, slowest = 0;
+    int failed = 0;
+    for(auto& job : jobs) {
+        bool ok = WIFEXITED(job.status) && !WEXITSTATUS(job.status);
+        failed += !ok;
+        total += job.secs;
+        slowest = max(slowest, job.secs);
+        ostringstream row;
+        row << (ok ? "PASS " : "FAIL ") << job.name << ": " << status(job) << ", " << (job.cycles.empty() ? "?" : job.cycles)
+            << " cycles, " << (job.insts.empty() ? "?" : job.insts) << " instructions, " << job.secs << " s";
+        cout << row.str() << endl;
+        summary << row.str() << "\n";
+        ifstream out(outdir + "/" + job.name + ".out");
+        for(string line; getline(out, line); ) summary << "    | " << line << "\n";
+    }
+    ostringstream totals;
+    totals << jobs.size() - failed << "/" << jobs.size() << " passed in " << wall << " s wall (slowest "
+           << slowest << " s, " << total << " s summed) with " << max_jobs << " jobs";
+    cout << totals.str() << endl;
+    summary << totals.str() << "\n";
+    return failed ? 1 : 0;
+}
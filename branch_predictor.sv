@@ -0,0 +1,123 @@
+// Front-end branch prediction for IFStage.  The fetched word is predecoded: conditional
+// branches take their target from the BTB when the direction counter says taken, other
+// jumps take it from the BTB alone, and returns (jalr through ra/t0) pop the return address
+// stack that calls (jal/jalr writing ra/t0) push.  Everything trains when the instruction
+// resolves in EX; when younger instructions are flushed the stack pointer is restored.
+module BranchPredictor #(
+    parameter MODE     = 2,  // 0: always not taken, 1: bimodal, 2: gshare
+    parameter PHT_BITS = 12, // 2^PHT_BITS 2-bit direction counters, at most 16
+    parameter BTB_BITS = 9,  // 2^BTB_BITS direct-mapped BTB entries
+    parameter RAS_BITS = 3   // 2^RAS_BITS return addresses, at most 8
+)(
+    input  logic         clk,
+    input  logic         reset,
+
+    input  logic [63:0]  pc,
+    input  logic [31:0]  instruction,
+    input  logic         valid,          // instruction is the word at pc
+    input  logic         fetch,          // and IF/ID takes it this cycle
+    output logic [63:0]  next_pc,
+    output branch_pred_t pred,
+
+    input  packed_inst   resolve_inst,   // instruction leaving EX, or zero
+    input  logic         resolve_taken,
+    input  logic [63:0]  resolve_target,
+    input  logic         recover,        // the instructions after recover_inst are being flushed
+    input  packed_inst   recover_inst
+);
+
+    localparam OP_BRANCH = 7'b1100011;
+    localparam OP_JAL    = 7'b1101111;
+    localparam OP_JALR   = 7'b1100111;
+    localparam TAG_BITS  = 64 - 2 - BTB_BITS;
+
+    function automatic logic is_link(input logic [4:0] r);
+        return r == 5'd1 || r == 5'd5;
+    endfunction
+
+    logic                btb_valid  [0:(1<<BTB_BITS)-1];
+    logic [TAG_BITS-1:0] btb_tag    [0:(1<<BTB_BITS)-1];
+    logic [63:0]         btb_target [0:(1<<BTB_BITS)-1];
+    logic [1:0]          pht        [0:(1<<PHT_BITS)-1];
+    logic [PHT_BITS-1:0] ghr;
+    logic [63:0]         ras        [0:(1<<RAS_BITS)-1];
+    logic [RAS_BITS-1:0] ras_ptr;
+
+    // predecode
+    logic [6:0] opcode;
+    logic       is_branch, is_jump, is_call, is_return;
+    assign opcode    = instruction[6:0];
+    assign is_branch = valid && opcode == OP_BRANCH;
+    assign is_jump   = valid && (opcode == OP_JAL || opcode == OP_JALR);
+    assign is_call   = is_jump && is_link(instruction[11:7]);
+    assign is_return = valid && opcode == OP_JALR && is_link(instruction[19:15]) && !is_link(instruction[11:7]);
+
+    logic [BTB_BITS-1:0] btb_index;
+    logic [PHT_BITS-1:0] pht_index;
+    logic                btb_hit;
+    assign btb_index = pc[2 +: BTB_BITS];
+    assign pht_index = pc[2 +: PHT_BITS] ^ (MODE == 2 ? ghr : '0);
+    assign btb_hit   = btb_valid[btb_index] && btb_tag[btb_index] == pc[63 -: TAG_BITS];
+
+    always_comb begin
+        pred         = '0;
+        pred.index   = 16'(pht_index);
+        pred.ras_ptr = 8'(ras_ptr);
+        if (MODE != 0) begin
+            if (is_return) begin
+                pred.taken   = 1'b1;
+                pred.target  = ras[ras_ptr];
+                pred.ras_ptr = 8'(ras_ptr - 1'b1);
+            end else if ((is_jump || (is_branch && pht[pht_index][1])) && btb_hit) begin
+                pred.taken   = 1'b1;
+                pred.target  = btb_target[btb_index];
+            end
+            if (is_call) pred.ras_ptr = 8'(ras_ptr + 1'b1);
+        end
+        next_pc = pred.taken ? pred.target : pc + 64'd4;
+    end
+
+    // training, from the instruction leaving EX
+    logic [BTB_BITS-1:0] resolve_btb_index;
+    logic [PHT_BITS-1:0] resolve_pht_index;
+    logic                resolve_branch, resolve_jump, resolve_return, recover_call;
+    assign resolve_btb_index = resolve_inst.addr[2 +: BTB_BITS];
+    assign resolve_pht_index = resolve_inst.pred.index[PHT_BITS-1:0];
+    assign resolve_branch    = resolve_inst.opcode == OP_BRANCH;
+    assign resolve_jump      = resolve_inst.opcode == OP_JAL || resolve_inst.opcode == OP_JALR;
+    assign resolve_return    = resolve_inst.opcode == OP_JALR && is_link(resolve_inst.rs1) && !is_link(resolve_inst.rd);
+    assign recover_call      = (recover_inst.opcode == OP_JAL || recover_inst.opcode == OP_JALR) && is_link(recover_inst.rd);
+
+    always_ff @(posedge clk or posedge reset) begin
+        if (reset) begin
+            ghr     <= '0;
+            ras_ptr <= '0;
+            for (int i = 0; i < (1<<BTB_BITS); i++) btb_valid[i] <= 1'b0;
+            for (int i = 0; i < (1<<PHT_BITS); i++) pht[i] <= 2'b01;
+        end else if (MODE != 0) begin
+            if (recover) begin
+                // wrong-path pushes may have overwritten the entry a mispredicted call pushed
+                ras_ptr <= recover_inst.pred.ras_ptr[RAS_BITS-1:0];
+                if (recover_call) ras[recover_inst.pred.ras_ptr[RAS_BITS-1:0]] <= recover_inst.addr + 64'd4;
+            end else if (fetch) begin
+                if (is_call) ras[ras_ptr + 1'b1] <= pc + 64'd4;
+                ras_ptr <= pred.ras_ptr[RAS_BITS-1:0];
+            end
+
+            if ((resolve_branch || resolve_jump) && resolve_taken && !resolve_return) begin
+                btb_valid[resolve_btb_index]  <= 1'b1;
+                btb_tag[resolve_btb_index]    <= resolve_inst.addr[63 -: TAG_BITS];
+                btb_target[resolve_btb_index] <= resolve_target;
+            end
+            if (resolve_branch) begin
+                // the counter it was predicted with, so gshare trains the history it saw
+                if (resolve_taken && pht[resolve_pht_index] != 2'b11)
+                    pht[resolve_pht_index] <= pht[resolve_pht_index] + 2'b01;
+                if (!resolve_taken && pht[resolve_pht_index] != 2'b00)
+                    pht[resolve_pht_index] <= pht[resolve_pht_index] - 2'b01;
+                ghr <= {ghr[PHT_BITS-2:0], resolve_taken};
+            end
+        end
+    end
+
+endmodule
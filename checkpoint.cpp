@@ -0,0 +1,182 @@
+#include <fstream>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <string.h>
+#include <assert.h>
+#include "system.h"
+#include "hardware.h"
+#if VM_SAVABLE
+# include "verilated_save.h"
+#endif
+
+using namespace std;
+
+#define CHECKPOINT_MAGIC   "CSE502CK"
+#define CHECKPOINT_VERSION (4)
+
+// Checkpoints are only taken while the memory system is drained (see checkpoint_drained()),
+// so the memory model itself is not saved: a restored run starts from an idle one.
+// The Verilated model goes to <filename>.vtop, everything else to <filename>.
+
+template<typename T> static void put(ostream& os, const T& v) { os.write((const char*)&v, sizeof(T)); }
+template<typename T> static void get(istream& is, T& v) { is.read((char*)&v, sizeof(T)); }
+
+bool System::checkpoint_drained() {
+    return transactions.empty() && !w_count;
+}
+
+void System::save_checkpoint(const char* filename) {
+#if VM_SAVABLE
+    memory->sync();
+    ofstream os(filename, ios::binary|ios::trunc);
+    if (!os) {
+        cerr << "Could not open checkpoint file " << filename << endl;
+        Verilated::gotFinish(true);
+        return;
+    }
+    os.write(CHECKPOINT_MAGIC, strlen(CHECKPOINT_MAGIC));
+    put(os, CHECKPOINT_VERSION);
+    put(os, ramsize);
+    put(os, ticks);
+    put(os, ecall_brk);
+    put(os, max_elf_addr);
+    put(os, errno_addr);
+    put(os, w_addr);
+    put(os, w_count);
+    put(os, interrupts);
+    put(os, rtc_get_state());
+    put(os, phys_page_used);
+    put(os, free_count);
+    put(os, page_rng);
+    os.write((const char*)free_pages.data(), free_count*sizeof(free_pages[0]));
+    put(os, r_queue);
+    put(os, resp_queue);
+    put(os, snoop_queue);
+    put(os, snoop_pending);
+    put(os, snoop_overflow.size());
+    for(uint64_t line : snoop_overflow) put(os, line);
+    save_pending_writes(os);
+
+    // ram: only the extents of the shared-memory file that were ever touched
+    uint64_t saved = 0;
+    off_t data = lseek(ram_fd, 0, SEEK_DATA);
+    while(data != -1 && (uint64_t)data < ramsize) {
+        off_t hole = lseek(ram_fd, data, SEEK_HOLE);
+        uint64_t ofs = data, len = hole - data;
+        put(os, ofs);
+        put(os, len);
+        os.write(&ram[ofs], len);
+        saved += len;
+        data = lseek(ram_fd, hole, SEEK_DATA);
+    }
+    put(os, (uint64_t)0);
+    put(os, (uint64_t)0);
+    os.close();
+
+    VerilatedSave vs;
+    vs.open((string(filename)+".vtop").c_str());
+    vs << *top;
+    vs.close();
+
+    cerr << "== Checkpoint " << filename << " at cycle " << std::dec << ticks/ps_per_clock
+         << " (" << saved/MEGA << " MB of ram)" << endl;
+#else
+    cerr << "Checkpoints need a savable model, rebuild with: make clean all SAVABLE=y" << endl;
+    Verilated::gotFinish(true);
+#endif
+}
+
+// rebuild the ram_virt aliases for every leaf of the guest page table at table_addr
+void System::remap_virt(uint64_t table_addr, int level, uint64_t vpn) {
+    for(int i = 0; i < 512; ++i) {
+        uint64_t pte = *(uint64_t*)&ram[table_addr + i*8];
+        if (!(pte & VALID_PAGE)) continue;
+        uint64_t page_addr = ((pte&0x0000ffffffffffff)>>10)<<12;
+        uint64_t next_vpn = (vpn << 9) | i;
+        if (level < 3) {
+            remap_virt(page_addr, level+1, next_vpn);
+        } else {
+            assert((next_vpn << 12) < ramsize);
+            void* new_virt = ram_virt + (next_vpn << 12);
+            assert(mmap(new_virt, PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, ram_fd, page_addr) == new_virt);
+        }
+    }
+}
+
+void System::restore_checkpoint(const char* filename) {
+#if VM_SAVABLE
+    ifstream is(filename, ios::binary);
+    char magic[sizeof(CHECKPOINT_MAGIC)] = { 0 };
+    int version = 0;
+    uint64_t saved_ramsize = 0;
+    is.read(magic, strlen(CHECKPOINT_MAGIC));
+    get(is, version);
+    get(is, saved_ramsize);
+    if (!is || strcmp(magic, CHECKPOINT_MAGIC) || version != CHECKPOINT_VERSION || saved_ramsize != ramsize) {
+        cerr << "Not a usable checkpoint: " << filename << endl;
+        exit(-1);
+    }
+    get(is, ticks);
+    get(is, ecall_brk);
+    get(is, max_elf_addr);
+    get(is, errno_addr);
+    get(is, w_addr);
+    get(is, w_count);
+    get(is, interrupts);
+    uint64_t rtc;
+    get(is, rtc);
+    rtc_set_state(rtc);
+    get(is, phys_page_used);
+    get(is, free_count);
+    get(is, page_rng);
+    assert(free_count <= free_pages.size());
+    is.read((char*)free_pages.data(), free_count*sizeof(free_pages[0]));
+    get(is, r_queue);
+    get(is, resp_queue);
+    get(is, snoop_queue);
+    get(is, snoop_pending);
+    size_t overflow;
+    get(is, overflow);
+    snoop_overflow.clear();
+    for(uint64_t line; overflow; --overflow) {
+        get(is, line);
+        snoop_overflow.insert(line);
+    }
+    restore_pending_writes(is);
+
+    // drop whatever the constructor loaded, then copy back the saved extents
+    assert(fallocate(ram_fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, 0, ramsize) == 0);
+    for(;;) {
+        uint64_t ofs, len;
+        get(is, ofs);
+        get(is, len);
+        if (!len) break;
+        assert(ofs + len <= ramsize);
+        is.read(&ram[ofs], len);
+    }
+    assert(is);
+
+    VerilatedRestore vr;
+    vr.open((string(filename)+".vtop").c_str());
+    vr >> *top;
+    vr.close();
+
+    tlb_flush();
+    if (use_virtual_memory) {
+        assert(mmap(ram_virt, ramsize, PROT_NONE, MAP_ANONYMOUS|MAP_PRIVATE|MAP_FIXED, -1, 0) == ram_virt);
+        remap_virt(top->satp, 0, 0);
+    }
+
+    // the memory model is idle, with nothing carried over from before the restore
+    memory->restart();
+    memory_update_started = false;
+
+    cerr << "== Restored " << filename << " at cycle " << std::dec << ticks/ps_per_clock << endl;
+#else
+    cerr << "Checkpoints need a savable model, rebuild with: make clean all SAVABLE=y" << endl;
+    exit(-1);
+#endif
+}
@@ -0,0 +1,103 @@
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <iostream>
+#include <fstream>
+#include <string>
+#include <map>
+#include "config.h"
+
+using namespace std;
+
+struct ConfigValue {
+    bool set;
+    string value;
+};
+static map<string, ConfigValue> options; // command line and config_set()
+static map<string, string> file;         // config file
+
+static bool split(const string& option, string& name, string& value) {
+    size_t eq = option.find('=');
+    if (eq == string::npos || eq == 0) return false;
+    name = option.substr(0, eq);
+    value = option.substr(eq + 1);
+    return true;
+}
+
+static void read_file(const char* filename) {
+    ifstream is(filename);
+    if (!is) {
+        cerr << "Cannot open config file " << filename << endl;
+        exit(-1);
+    }
+    string line, name, value;
+    for(int n = 1; getline(is, line); ++n) {
+        line = line.substr(0, line.find('#'));
+        size_t start = line.find_first_not_of(" \t"), end = line.find_last_not_of(" \t\r");
+        if (start == string::npos) continue;
+        if (!split(line.substr(start, end + 1 - start), name, value)) {
+            cerr << filename << ":" << n << ": expected NAME=value" << endl;
+            exit(-1);
+        }
+        file[name] = value;
+    }
+}
+
+void config_init(int& argc, char**& argv) {
+    int i = 1;
+    string name, value;
+    for(; i < argc && !strncmp(argv[i], "--", 2); ++i) {
+        if (!strcmp(argv[i], "--")) {
+            ++i;
+            break;
+        }
+        if (!split(argv[i] + 2, name, value)) {
+            cerr << "Expected --NAME=value before the program path, got " << argv[i] << endl;
+            exit(-1);
+        }
+        if (name == "config") name = "CONFIG";
+        options[name] = ConfigValue{true, value};
+    }
+    // keep argv[0] and the program with its arguments
+    argv[i-1] = argv[0];
+    argc -= i-1;
+    argv += i-1;
+
+    const char* CONFIG = config_get("CONFIG");
+    if (CONFIG) read_file(CONFIG);
+}
+
+const char* config_get(const char* name) {
+    map<string, ConfigValue>::const_iterator o = options.find(name);
+    if (o != options.end()) return o->second.set ? o->second.value.c_str() : NULL;
+    const char* env = getenv(name);
+    if (env) return env;
+    map<string, string>::const_iterator f = file.find(name);
+    return f != file.end() ? f->second.c_str() : NULL;
+}
+
+uint64_t config_number(const char* name, uint64_t dflt) {
+    const char* val = config_get(name);
+    if (!val) return dflt;
+    char* end;
+    uint64_t n = strtoull(val, &end, 0);
+    switch(toupper(*end)) {
+        case 'G': n *= 1024; // fall through
+        case 'M': n *= 1024; // fall through
+        case 'K': n *= 1024; ++end;
+    }
+    if (end == val || *end) {
+        cerr << "Expected a number for " << name << ", got " << val << endl;
+        exit(-1);
+    }
+    return n;
+}
+
+bool config_flag(const char* name) {
+    const char* val = config_get(name);
+    return val && toupper(*val) == 'Y';
+}
+
+void config_set(const char* name, const char* value) {
+    options[name] = value ? ConfigValue{true, value} : ConfigValue{false, ""};
+}
@@ -0,0 +1,18 @@
+#ifndef __CONFIG_H
+#define __CONFIG_H
+
+#include <stdint.h>
+
+// Simulator parameters, by the same NAMEs the environment has always used.  A lookup
+// returns the first of
+//   --NAME=value options, given before the program path (or set by config_set()),
+//   the NAME environment variable,
+//   a NAME=value line of the config file (--config=<file> or CONFIG=<file>; # starts a comment),
+// or NULL, in which case the caller uses its default.
+void config_init(int& argc, char**& argv); // takes the options out of argv
+const char* config_get(const char* name);
+uint64_t config_number(const char* name, uint64_t dflt); // also accepts K, M and G suffixes
+bool config_flag(const char* name);                      // y or Y
+void config_set(const char* name, const char* value);    // NULL hides lower-priority values
+
+#endif
@@ -1,4 +1,6 @@
-module ControlUnit (
+module ControlUnit #(
+    parameter FORWARDING = 1   // EX bypasses EX/MEM and MEM/WB: only a load followed by its consumer stalls
+)(
 
     input  packed_inst    if_id_inst,   
     input  packed_inst    id_ex_inst,   
@@ -13,9 +15,20 @@ module ControlUnit (
     input  logic         read_done,       
     input  logic         write_done,       
     input  logic         ecall_stall,
-    input  logic         mem_branch_taken,
+    input  logic         ex_mispredict,   // the branch or jalr in EX does not continue where fetch went
+    input  logic         id_jump,         // the jal in decode was not predicted taken to its target
     input  logic         icache_valid_if,
 
+    // the DCache scoreboard: registers loads that missed have yet to write, and the load in MEM
+    // that misses this cycle (its rd is not in pending_regs yet)
+    input  logic [31:0]  pending_regs,
+    input  logic         load_pending,
+    input  logic         mshr_busy,
+
+    // fetch is redirected this cycle: by the instruction leaving EX, or by the jal moving out of decode
+    output   logic         ex_redirect,
+    output   logic         id_redirect,
+
 
     output   logic         flush_if_id,
     output   logic         flush_id_ex,
@@ -26,7 +39,21 @@ module ControlUnit (
     output   logic         enable_id_ex,
     output   logic         enable_ex_mem,
     output   logic         enable_mem_wb,
-    output   logic         enable_pc
+    output   logic         enable_pc,
+
+    // stall causes this cycle, for the performance counters
+    output   logic         load_stall,
+    output   logic         store_stall,
+    output   logic         raw_id_ex,
+    output   logic         raw_ex_mem,
+    output   logic         raw_mem_wb,
+    output   logic         pending_stall,
+
+    // what the bubble each flush inserts is charged to in the CPI stack
+    output   stall_cause_t flush_cause_if_id,
+    output   stall_cause_t flush_cause_id_ex,
+    output   stall_cause_t flush_cause_ex_mem,
+    output   stall_cause_t flush_cause_mem_wb
 );
 
 
@@ -52,14 +79,14 @@ module ControlUnit (
         flush_id_ex   = 1'b0;
         flush_ex_mem  = 1'b0;
         flush_mem_wb  = 1'b0;
-        
-        if (mem_branch_taken) begin
-
-            flush_if_id = 1'b1;
-            flush_id_ex = 1'b1;
-            flush_ex_mem  = 1'b1;
-            //$display("Detected control hazard: branch_taken_ex=%d. Inserting bubble by flushing.", mem_branch_taken);
-        end 
+        load_stall    = 1'b0;
+        store_stall   = 1'b0;
+        raw_id_ex     = 1'b0;
+        raw_ex_mem    = 1'b0;
+        raw_mem_wb    = 1'b0;
+        pending_stall = 1'b0;
+        ex_redirect   = 1'b0;
+        id_redirect   = 1'b0;
 
         // ECALL Detection 
         if (ecall_stall ) begin //AKA TODO - CHECK THIS I THINK WE NEED TO DO LIKE ABOVE
@@ -78,6 +105,7 @@ module ControlUnit (
 
             if (ex_mem_inst.mem_read && !read_done) begin
 
+                load_stall     = 1'b1;
                 stall_pc       = 1'b1;
                 flush_mem_wb   = 1'b1;
                 stall_ex_mem   = 1'b1;
@@ -86,6 +114,7 @@ module ControlUnit (
 
             if (ex_mem_inst.mem_write && !write_done) begin
 
+                store_stall    = 1'b1;
                 stall_pc       = 1'b1;
                 flush_mem_wb   = 1'b1;
                 stall_ex_mem   = 1'b1;
@@ -93,39 +122,104 @@ module ControlUnit (
             end
 
 
-            if (!mem_wb_flush_out && mem_wb_inst.reg_write && (mem_wb_inst.rd != '0) &&
-                ((mem_wb_inst.rd == if_id_rs1) || (mem_wb_inst.rd == if_id_rs2))) begin
+            if (FORWARDING) begin
 
-                stall_if_id   = 1'b1;
-                flush_id_ex   = 1'b1;
-                stall_pc      = 1'b1;
-                //$display("Detected RAW hazard with MEM/WB: mem_wb_rd=x%0d, if_id_rs1=x%0d, if_id_rs2=x%0d",mem_wb_inst.rd, if_id_rs1, if_id_rs2);
-            end
+                if (!id_ex_flush_out && id_ex_inst.mem_read && (id_ex_inst.rd != '0) &&
+                    ((id_ex_inst.rd == if_id_rs1) || (id_ex_inst.rd == if_id_rs2))) begin
 
-            if (!ex_mem_flush_out && ex_mem_inst.reg_write && (ex_mem_inst.rd != '0) &&
-                ((ex_mem_inst.rd == if_id_rs1) || (ex_mem_inst.rd == if_id_rs2))) begin
+                    raw_id_ex   = 1'b1;
+                    stall_if_id = 1'b1;
+                    flush_id_ex = 1'b1;
+                    stall_pc    = 1'b1;
+                    //$display("Detected load-use hazard: id_ex_rd=x%0d, if_id_rs1=x%0d, if_id_rs2=x%0d",id_ex_inst.rd, if_id_rs1, if_id_rs2);
+                end
+
+            end else begin
+
+                if (!mem_wb_flush_out && mem_wb_inst.reg_write && (mem_wb_inst.rd != '0) &&
+                    ((mem_wb_inst.rd == if_id_rs1) || (mem_wb_inst.rd == if_id_rs2))) begin
+
+                    raw_mem_wb    = 1'b1;
+                    stall_if_id   = 1'b1;
+                    flush_id_ex   = 1'b1;
+                    stall_pc      = 1'b1;
+                    //$display("Detected RAW hazard with MEM/WB: mem_wb_rd=x%0d, if_id_rs1=x%0d, if_id_rs2=x%0d",mem_wb_inst.rd, if_id_rs1, if_id_rs2);
+                end
+
+                if (!ex_mem_flush_out && ex_mem_inst.reg_write && (ex_mem_inst.rd != '0) &&
+                    ((ex_mem_inst.rd == if_id_rs1) || (ex_mem_inst.rd == if_id_rs2))) begin
+
+                    raw_ex_mem  = 1'b1;
+                    stall_if_id = 1'b1;
+                    flush_id_ex   = 1'b1;
+                    stall_pc    = 1'b1;           
+                    //$display("Detected RAW hazard with EX/MEM: ex_mem_rd=x%0d, if_id_rs1=x%0d, if_id_rs2=x%0d",ex_mem_inst.rd, if_id_rs1, if_id_rs2);
+                end
+
+                if (!id_ex_flush_out && id_ex_inst.reg_write && (id_ex_inst.rd != '0) &&
+                    ((id_ex_inst.rd == if_id_rs1) || (id_ex_inst.rd == if_id_rs2))) begin
+
+                    raw_id_ex   = 1'b1;
+                    stall_if_id = 1'b1;
+                    flush_id_ex   = 1'b1;
+                    stall_pc    = 1'b1;
+                    //$display("Detected RAW hazard with ID/EX: id_ex_rd=x%0d, if_id_rs1=x%0d, if_id_rs2=x%0d",id_ex_inst.rd, if_id_rs1, if_id_rs2);
+                end     
 
-                stall_if_id = 1'b1;
-                flush_id_ex   = 1'b1;
-                stall_pc    = 1'b1;           
-                //$display("Detected RAW hazard with EX/MEM: ex_mem_rd=x%0d, if_id_rs1=x%0d, if_id_rs2=x%0d",ex_mem_inst.rd, if_id_rs1, if_id_rs2);
             end
 
-            if (!id_ex_flush_out && id_ex_inst.reg_write && (id_ex_inst.rd != '0) &&
-                ((id_ex_inst.rd == if_id_rs1) || (id_ex_inst.rd == if_id_rs2))) begin
+            // A consumer of a load that missed waits for its refill; an ECALL waits for all of
+            // them, and for the load in EX that may still miss, since it reads its arguments in
+            // WB without naming them.  Younger writes cancel the refill's.
+            if (((if_id_rs1 != '0) && (pending_regs[if_id_rs1] || (load_pending && ex_mem_inst.rd == if_id_rs1))) ||
+                ((if_id_rs2 != '0) && (pending_regs[if_id_rs2] || (load_pending && ex_mem_inst.rd == if_id_rs2))) ||
+                (if_id_inst.ecall_flag && (mshr_busy || load_pending || (!id_ex_flush_out && id_ex_inst.mem_read)))) begin
 
-                stall_if_id = 1'b1;
+                pending_stall = 1'b1;
+                stall_if_id   = 1'b1;
                 flush_id_ex   = 1'b1;
-                stall_pc    = 1'b1;
-                //$display("Detected RAW hazard with ID/EX: id_ex_rd=x%0d, if_id_rs1=x%0d, if_id_rs2=x%0d",id_ex_inst.rd, if_id_rs1, if_id_rs2);
-            end     
+                stall_pc      = 1'b1;
+            end
           
         end
+
+        // A mispredicted branch redirects as it moves from EX to MEM, flushing the two younger
+        // instructions; their hazards no longer matter.  A jal redirects as it moves into EX,
+        // so only the instruction fetched behind it is lost.
+        if (ex_mispredict && !id_ex_flush_out && !stall_ex_mem && !ecall_stall) begin
+
+            ex_redirect = 1'b1;
+            flush_if_id = 1'b1;
+            flush_id_ex = 1'b1;
+            stall_if_id = 1'b0;
+            stall_pc    = 1'b0;
+            raw_id_ex   = 1'b0;
+            raw_ex_mem  = 1'b0;
+            raw_mem_wb  = 1'b0;
+            pending_stall = 1'b0;
+            //$display("Detected control hazard: mispredict in EX. Flushing IF/ID and ID/EX.");
+        end else if (id_jump && !if_id_flush_out && !stall_ex_mem && !stall_if_id && !ecall_stall) begin
+
+            id_redirect = 1'b1;
+            flush_if_id = 1'b1;
+        end
+
+        // the oldest cause wins: ECALL in WB, then the miss in MEM or branch in EX, then the RAW
+        // hazard with the closest producer, which is the one that keeps IF/ID stalled longest;
+        // waiting for a refill is charged to the load miss
+        flush_cause_if_id  = ecall_stall ? CAUSE_ECALL : CAUSE_BRANCH;
+        flush_cause_id_ex  = ecall_stall      ? CAUSE_ECALL :
+                             ex_redirect      ? CAUSE_BRANCH :
+                             raw_id_ex        ? CAUSE_RAW_ID_EX :
+                             raw_ex_mem       ? CAUSE_RAW_EX_MEM :
+                             raw_mem_wb       ? CAUSE_RAW_MEM_WB : CAUSE_LOAD;
+        flush_cause_ex_mem = CAUSE_ECALL;
+        flush_cause_mem_wb = ecall_stall ? CAUSE_ECALL : load_stall ? CAUSE_LOAD : CAUSE_STORE;
     end
     assign enable_mem_wb = !stall_mem_wb;
     assign enable_ex_mem = !stall_ex_mem;
     assign enable_id_ex = enable_ex_mem && !stall_id_ex;
-    assign enable_if_id = (enable_id_ex && !stall_if_id) || mem_branch_taken || ecall_stall;
-    assign enable_pc = enable_if_id && icache_valid_if && !mem_branch_taken && !ecall_stall;
+    assign enable_if_id = (enable_id_ex && !stall_if_id) || ex_redirect || ecall_stall;
+    assign enable_pc = enable_if_id && icache_valid_if && !ex_redirect && !id_redirect && !ecall_stall;
 
 endmodule
@@ -5,7 +5,8 @@ module DCache #(
     parameter NUMBER_OF_SETS = 512,
     parameter NUMBER_OF_WAYS = 2,
     parameter ID_WIDTH = 13,
-    parameter STRB_WIDTH  = DATA_WIDTH / 8
+    parameter STRB_WIDTH  = DATA_WIDTH / 8,
+    parameter NUM_MSHRS = 2     // load misses outstanding before a further miss blocks, at least 1
 )(
     input  logic                  clk,
     input  logic                  reset,
@@ -18,6 +19,20 @@ module DCache #(
     output logic [DATA_WIDTH-1:0] read_data_out,  
     output logic                  read_valid_out,     
     output logic                  write_valid_out,     
+
+    // Miss status holding registers.  A load that misses is done once it has one: it carries
+    // on without its data (pending_out), and the refill writes rd when it completes (fill_*).
+    input  logic [4:0]            rd_in,
+    input  logic [2:0]            funct3_in,
+    input  logic                  hold,             // the load is being flushed: do not take an MSHR
+    input  logic                  wb_enable_in,     // a younger write to an MSHR's rd cancels its fill
+    input  logic [4:0]            wb_rd_in,
+    output logic                  pending_out,
+    output logic                  fill_valid_out,
+    output logic [4:0]            fill_rd_out,
+    output logic [2:0]            fill_funct3_out,
+    output logic [DATA_WIDTH-1:0] fill_data_out,
+    output logic [31:0]           pending_regs_out, // registers still waiting for a refill
     
     output logic [ID_WIDTH-1:0]   m_axi_arid,
     output logic [ADDR_WIDTH-1:0] m_axi_araddr,
@@ -62,7 +77,14 @@ module DCache #(
     input  logic                     m_axi_acvalid,
     output logic                     m_axi_acready,
     input  logic [ADDR_WIDTH-1:0]    m_axi_acaddr,
-    input  logic [3:0]               m_axi_acsnoop
+    input  logic [3:0]               m_axi_acsnoop,
+
+    output logic                     miss_out,      // a refill starts or an MSHR is taken this cycle
+    output logic                     refilling_out, // a refill is in progress
+    output logic                     mshr_busy_out,        // a load miss is outstanding
+    output logic                     hit_under_miss_out,   // a hit served while one is
+    output logic                     miss_under_miss_out,  // an MSHR taken while one is
+    output logic                     mshr_stall_out        // the access waits for the MSHRs
 );
     
     typedef struct packed {
@@ -74,18 +96,59 @@ module DCache #(
     cache_line_t cache [0:NUMBER_OF_SETS-1][0:NUMBER_OF_WAYS-1];
 
     logic lru [0:NUMBER_OF_SETS-1];
+    logic [63:0] warm_addr;
 
     localparam OFFSET_BITS = 6; 
-    localparam INDEX_BITS  = 9; 
+    localparam INDEX_BITS  = $clog2(NUMBER_OF_SETS);
     localparam TAG_BITS    = ADDR_WIDTH - OFFSET_BITS - INDEX_BITS; 
 
+    localparam LINE_BITS   = ADDR_WIDTH - OFFSET_BITS;
+    localparam MSHR_BITS   = NUM_MSHRS > 1 ? $clog2(NUM_MSHRS) : 1;
+
     logic [OFFSET_BITS-1:0] offset; 
     logic [INDEX_BITS-1:0]  index;  
     logic [TAG_BITS-1:0]    tag;    
+    logic [LINE_BITS-1:0]   line;
 
     assign offset = address_in[OFFSET_BITS-1:0]; 
     assign index  = address_in[OFFSET_BITS +: INDEX_BITS]; 
     assign tag    = address_in[ADDR_WIDTH-1 -: TAG_BITS]; 
+    assign line   = address_in[ADDR_WIDTH-1 -: LINE_BITS];
+
+    // MSHRs, refilled in the order they were taken: the arbiter has one read in flight at a time
+    logic                   mshr_valid  [0:NUM_MSHRS-1];
+    logic [LINE_BITS-1:0]   mshr_line   [0:NUM_MSHRS-1];
+    logic [OFFSET_BITS-1:0] mshr_offset [0:NUM_MSHRS-1];
+    logic [1:0]             mshr_size   [0:NUM_MSHRS-1];
+    logic [4:0]             mshr_rd     [0:NUM_MSHRS-1];
+    logic [2:0]             mshr_funct3 [0:NUM_MSHRS-1];
+    logic [MSHR_BITS-1:0]   mshr_head, mshr_tail;
+    logic                   mshr_busy, mshr_full, line_pending, mshr_alloc, mshr_free;
+
+    always_comb begin
+        mshr_busy    = 1'b0;
+        mshr_full    = 1'b1;
+        line_pending = 1'b0;
+        for (int i = 0; i < NUM_MSHRS; i++) begin
+            mshr_busy    = mshr_busy || mshr_valid[i];
+            mshr_full    = mshr_full && mshr_valid[i];
+            line_pending = line_pending || (mshr_valid[i] && mshr_line[i] == line);
+        end
+    end
+
+    function automatic logic [MSHR_BITS-1:0] mshr_next(input logic [MSHR_BITS-1:0] i);
+        return (i == MSHR_BITS'(NUM_MSHRS-1)) ? '0 : i + 1'b1;
+    endfunction
+
+    // the line a refill is for, and where it goes: the oldest MSHR's, or this access's
+    logic [LINE_BITS-1:0]   refill_line;
+    logic [INDEX_BITS-1:0]  refill_index;
+    logic [TAG_BITS-1:0]    refill_tag;
+    logic                   refill_way;
+    assign refill_line  = mshr_busy ? mshr_line[mshr_head] : line;
+    assign refill_index = refill_line[INDEX_BITS-1:0];
+    assign refill_tag   = refill_line[LINE_BITS-1 -: TAG_BITS];
+    assign refill_way   = lru[refill_index];
 
     logic [INDEX_BITS-1:0] snoop_index = m_axi_acaddr[OFFSET_BITS +: INDEX_BITS];
     logic [TAG_BITS-1:0] snoop_tag = m_axi_acaddr[ADDR_WIDTH-1 -: TAG_BITS];
@@ -104,35 +167,31 @@ module DCache #(
                           (hit_way1) ? 1'b1 :
                           lru[index]; 
 
+    function automatic logic [DATA_WIDTH-1:0] load_data(input logic [CACHE_LINE_SIZE-1:0] data,
+                                                        input logic [OFFSET_BITS-1:0] offset, input logic [1:0] size);
+        case (size)
+            2'b00:   return {{56{data[(offset * 8) +: 8][7]}},   data[(offset * 8) +: 8]};  // Byte
+            2'b01:   return {{48{data[(offset * 8) +: 16][15]}}, data[(offset * 8) +: 16]}; // Half-word
+            2'b10:   return {{32{data[(offset * 8) +: 32][31]}}, data[(offset * 8) +: 32]}; // Word
+            default: return data[(offset * 8) +: 64];                                       // Double-word
+        endcase
+    endfunction
+
     always_comb begin
         read_valid_out = 1'b0;
         if (valid_in && !store_enable && (hit_way0 || hit_way1)) begin
-            case (size_in)
-                2'b00: begin // Byte
-                    read_data_out = {{56{cache[index][selected_way].data[(offset * 8) +:8][7]}}, cache[index][selected_way].data[(offset * 8) +:8]};
-                end
-                2'b01: begin // Half-word
-                    read_data_out = {{48{cache[index][selected_way].data[(offset * 8) +:16][15]}}, cache[index][selected_way].data[(offset * 8) +:16]};
-                end
-                2'b10: begin // Word
-                    read_data_out = {{32{cache[index][selected_way].data[(offset * 8) +:32][31]}}, cache[index][selected_way].data[(offset * 8) +:32]};
-                end
-                2'b11: begin // Double-word
-                    read_data_out = cache[index][selected_way].data[(offset * 8) +:64];
-                end
-                default: begin
-                    read_data_out = '0;
-                end
-            endcase
+            read_data_out = load_data(cache[index][selected_way].data, offset, size_in);
             read_valid_out = 1'b1;
         end else begin
             read_data_out = '0;
         end
+        // a miss on a line no MSHR is refilling yet takes a free one
+        if (mshr_alloc) read_valid_out = 1'b1;
     end
 
     always_comb begin
         write_valid_out = 1'b0;
-        if (current_state == IDLE && (need_write && (hit_way0 || hit_way1))) begin
+        if (need_write && (hit_way0 || hit_way1)) begin
             write_valid_out = 1'b1;
         end
         if (current_state == UPDATE_CACHE_FOR_WRITE && next_state == IDLE) begin
@@ -140,6 +199,28 @@ module DCache #(
         end
     end
 
+    assign mshr_alloc       = need_refill && !line_pending && !mshr_full && !hold;
+    assign mshr_free        = current_state == UPDATE_CACHE;
+    assign pending_out      = mshr_alloc;
+    assign fill_valid_out   = mshr_free;
+    assign fill_rd_out      = mshr_rd[mshr_head];
+    assign fill_funct3_out  = mshr_funct3[mshr_head];
+    assign fill_data_out    = load_data(refill_data, mshr_offset[mshr_head], mshr_size[mshr_head]);
+
+    always_comb begin
+        pending_regs_out = '0;
+        for (int i = 0; i < NUM_MSHRS; i++) begin
+            // the refill completing this cycle is written back already
+            if (mshr_valid[i] && !(mshr_free && MSHR_BITS'(i) == mshr_head)) pending_regs_out[mshr_rd[i]] = 1'b1;
+        end
+        pending_regs_out[0] = 1'b0;
+    end
+
+    assign mshr_busy_out       = mshr_busy;
+    assign hit_under_miss_out  = mshr_busy && valid_in && (hit_way0 || hit_way1);
+    assign miss_under_miss_out = mshr_busy && mshr_alloc;
+    assign mshr_stall_out      = valid_in && !hold && !(hit_way0 || hit_way1) && !mshr_alloc && (!store_enable || mshr_busy);
+
     typedef enum logic [3:0] {
         IDLE,
         INITIATE_READ,
@@ -165,11 +246,19 @@ module DCache #(
     assign need_refill = valid_in && !store_enable && !(hit_way0 || hit_way1);
     assign need_write  = valid_in && store_enable;
 
+    assign miss_out      = mshr_alloc || (current_state == IDLE && next_state == INITIATE_READ_FOR_WRITE);
+    assign refilling_out = current_state == INITIATE_READ || current_state == WAIT_READ || current_state == UPDATE_CACHE
+                        || current_state == INITIATE_READ_FOR_WRITE || current_state == WAIT_READ_FOR_WRITE
+                        || current_state == UPDATE_CACHE_FOR_WRITE;
+
     always_comb begin
         next_state = current_state;
         case (current_state)
             IDLE: begin
-                if (need_refill) begin
+                // snoops go first; a store miss waits until the load misses are refilled
+                if (m_axi_acvalid && (m_axi_acsnoop == 4'hd)) begin
+                    next_state = IDLE;
+                end else if (mshr_busy || mshr_alloc) begin
                     next_state = INITIATE_READ;
                 end else if (need_write && (hit_way0 || hit_way1)) begin
                     next_state = IDLE;
@@ -248,18 +337,64 @@ module DCache #(
             write_beat_counter <= 0;
             refill_data        <= '0;
             m_axi_acready      <= 1'b0;
+            mshr_head          <= '0;
+            mshr_tail          <= '0;
+            for (int i = 0; i < NUM_MSHRS; i++) mshr_valid[i] <= 1'b0;
 
             for (int i = 0; i < NUMBER_OF_SETS; i++) begin
                 lru[i] = 1'b0;
                 for (int j = 0; j < NUMBER_OF_WAYS; j++) begin
-                    cache[i][j].valid = 1'b0;
-                    cache[i][j].tag   = '0;
-                    cache[i][j].data  = '0;
+                    // preload the lines the fast-forward ISS left in this set, if any
+                    warm_addr = cache_warm_line(1, i, j);
+                    cache[i][j].valid = (warm_addr != '1);
+                    cache[i][j].tag   = warm_addr[ADDR_WIDTH-1 -: TAG_BITS];
+                    for (int k = 0; k < CACHE_LINE_SIZE/64; k++) begin
+                        cache[i][j].data[k*64 +: 64] = (warm_addr != '1) ? cache_warm_data(warm_addr + k*8) : '0;
+                    end
                 end
             end
         end else begin
             current_state <= next_state;
 
+            if (mshr_alloc) begin
+                mshr_valid[mshr_tail]  <= 1'b1;
+                mshr_line[mshr_tail]   <= line;
+                mshr_offset[mshr_tail] <= offset;
+                mshr_size[mshr_tail]   <= size_in;
+                mshr_rd[mshr_tail]     <= rd_in;
+                mshr_funct3[mshr_tail] <= funct3_in;
+                mshr_tail              <= mshr_next(mshr_tail);
+            end
+            for (int i = 0; i < NUM_MSHRS; i++) begin
+                if (mshr_valid[i] && wb_enable_in && mshr_rd[i] == wb_rd_in) mshr_rd[i] <= 5'd0;
+            end
+            if (mshr_free) begin
+                mshr_valid[mshr_head] <= 1'b0;
+                mshr_head             <= mshr_next(mshr_head);
+            end
+
+            // store hits are served whatever the refill is doing; a line being refilled replaces them
+            if (need_write && (hit_way0 || hit_way1)) begin
+                case (size_in)
+                    2'b00: begin // Store Byte (sb)
+                        cache[index][selected_way].data[(offset * 8) +: 8]   <=  data_in[7:0];
+                    end
+                    2'b01: begin // Store Half-Word (sh)
+                        cache[index][selected_way].data[(offset * 8) +: 16]  <=  data_in[15:0];
+                    end
+                    2'b10: begin // Store Word (sw)
+                        cache[index][selected_way].data[(offset * 8) +: 32]  <=  data_in[31:0];
+                    end
+                    2'b11: begin // Store Double-Word (sd)
+                        cache[index][selected_way].data[(offset * 8) +: 64]  <=  data_in;
+                    end
+                    default: begin
+                        //$display("we shouldnt be here");
+                        cache[index][selected_way].data[(offset * 8) +: 64]  <=  '0; // Default to 0 for undefined sizes
+                    end
+                endcase  
+            end
+
             case (current_state)
                 IDLE: begin
                     if (m_axi_acvalid && (m_axi_acsnoop == 4'hd)) begin
@@ -269,40 +404,21 @@ module DCache #(
                                 cache[snoop_index][way].valid <= 1'b0;
                             end
                         end               
+                    end else if (mshr_busy || mshr_alloc) begin
+
+                        m_axi_araddr  <= {refill_line, {OFFSET_BITS{1'b0}}}; 
+                        m_axi_arvalid <= 1'b1;
+                        m_axi_arid    <= 'd1; 
+                        m_axi_arlen    <= 8'd7;       
+                        m_axi_arsize   <= 3'd3;      
+                        m_axi_arburst  <= 2'b01;    
+                        m_axi_arlock   <= 1'b0;
+                        m_axi_arcache  <= 4'b0011;
+                        m_axi_arprot   <= 3'b000;
+
                     end else if (valid_in) begin
 
-                        if (need_refill) begin
-
-                            m_axi_araddr  <= {tag, index, {OFFSET_BITS{1'b0}}}; 
-                            m_axi_arvalid <= 1'b1;
-                            m_axi_arid    <= 'd1; 
-                            m_axi_arlen    <= 8'd7;       
-                            m_axi_arsize   <= 3'd3;      
-                            m_axi_arburst  <= 2'b01;    
-                            m_axi_arlock   <= 1'b0;
-                            m_axi_arcache  <= 4'b0011;
-                            m_axi_arprot   <= 3'b000;
-                                
-                        end else if (need_write && (hit_way0 || hit_way1)) begin
-                            case (size_in)
-                                2'b00: begin // Store Byte (sb)
-                                    cache[index][selected_way].data[(offset * 8) +: 8]   <=  data_in[7:0];
-                                end
-                                2'b01: begin // Store Half-Word (sh)
-                                    cache[index][selected_way].data[(offset * 8) +: 16]  <=  data_in[15:0];
-                                end
-                                2'b10: begin // Store Word (sw)
-                                    cache[index][selected_way].data[(offset * 8) +: 32]  <=  data_in[31:0];
-                                end
-                                2'b11: begin // Store Double-Word (sd)
-                                    cache[index][selected_way].data[(offset * 8) +: 64]  <=  data_in;
-                                end
-                                default: begin
-                                    //$display("we shouldnt be here");
-                                    cache[index][selected_way].data[(offset * 8) +: 64]  <=  '0; // Default to 0 for undefined sizes
-                                end
-                            endcase  
-                        end else if (need_write && !(hit_way0 || hit_way1)) begin
+                        if (need_write && !(hit_way0 || hit_way1)) begin
 
                             m_axi_araddr  <= {tag, index, {OFFSET_BITS{1'b0}}}; 
                             m_axi_arvalid <= 1'b1;
@@ -340,11 +456,11 @@ module DCache #(
 
                 UPDATE_CACHE: begin
 
-                    cache[index][selected_way].valid <= 1'b1;
-                    cache[index][selected_way].tag   <= tag;
-                    cache[index][selected_way].data  <= refill_data;
+                    cache[refill_index][refill_way].valid <= 1'b1;
+                    cache[refill_index][refill_way].tag   <= refill_tag;
+                    cache[refill_index][refill_way].data  <= refill_data;
 
-                    lru[index] <= ~selected_way;
+                    lru[refill_index] <= ~refill_way;
                 end
 
                 INITIATE_WRITE_ADDR: begin
@@ -1,6 +1,7 @@
 module Decode (
     input  logic [63:0] addr,  
     input  logic [31:0] instr, 
+    input  branch_pred_t pred,
     output packed_inst out_instr,
     output string        out_str
 );
@@ -8,6 +9,7 @@ module Decode (
     always_comb begin
         string outstr;
         out_instr.addr   = addr;
+        out_instr.pred   = pred;
         out_instr.opcode = instr[6:0];
         out_instr.rd     = instr[11:7];
         out_instr.funct3 = instr[14:12];
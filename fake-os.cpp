@@ -1,5 +1,7 @@
 #include <iostream>
-#include <set>
+#include <algorithm>
+#include <string.h>
+#include <assert.h>
 #include <sys/mman.h>
 #include <sys/uio.h>
 #include <syscall.h>
@@ -9,14 +11,33 @@ using namespace std;
 
 extern "C" {
 
-#define MAX_PENDING_WRITES 1000
+#define MAX_PENDING_LINES 256
 #define DEBUG_WRITES 0
 
-    map<long long, char> pending_writes;
+    // committed stores that have not reached memory yet, one entry per cache line
+    struct PendingLine {
+        uint64_t mask; // bit i set when byte i holds a pending value
+        char data[64];
+    };
+    FlatMap<PendingLine, 2*MAX_PENDING_LINES> pending_writes;
+
+    static void merge_line(long long line, const PendingLine& pl) {
+        if (DEBUG_WRITES) cerr << "Merging in pending writes for line 0x" << std::hex << line << " mask 0x" << pl.mask << endl;
+        for(uint64_t m = pl.mask; m; m &= m-1) {
+            int i = __builtin_ctzll(m);
+            System::sys->ram[line+i] = pl.data[i];
+        }
+    }
 
     void do_finish_write(long long addr, int size) {
-        for(int i = 0; i < size; ++i)
-            pending_writes.erase(addr+i);
+        for(long long line = addr & ~63LL; line < addr+size; line += 64) {
+            PendingLine* pl = pending_writes.find(line);
+            if (!pl) continue;
+            long long from = max(addr, line), to = min(addr+size, line+64);
+            uint64_t bits = (to-from == 64) ? ~0ULL : ((1ULL << (to-from)) - 1) << (from-line);
+            pl->mask &= ~bits;
+            if (!pl->mask) pending_writes.erase(pl);
+        }
     }
 
     void do_pending_write(long long addr, long long val, int size) {
@@ -25,26 +46,55 @@ extern "C" {
           Verilated::gotFinish(true);
           return;
         }
-        if (pending_writes.size() > MAX_PENDING_WRITES) {
-            for(int i = 0; i < MAX_PENDING_WRITES/10; ++i) {
-                auto pw = pending_writes.begin();
-                if (DEBUG_WRITES) cerr << "(Overflow) Merging in pending write for address 0x" << std::hex << pw->first << " value 0x" << (int)((char)(pw->second)) << endl;
-                System::sys->ram[pw->first] = pw->second;
-                pending_writes.erase(pw);
+        if (DEBUG_WRITES) cerr << "Received pending write for address 0x" << std::hex << addr << " value 0x" << val << " size " << std::dec << size << endl;
+        for(int ofs = 0; ofs < size; ) {
+            long long line = (addr+ofs) & ~63LL;
+            PendingLine* pl = pending_writes.find(line);
+            if (!pl) {
+                if (pending_writes.size() >= MAX_PENDING_LINES) {
+                    // overflow: everything goes to memory
+                    pending_writes.for_each(merge_line);
+                    pending_writes.clear();
+                }
+                pl = &pending_writes.insert(line, PendingLine{0, {0}});
+            }
+            // a misaligned store may continue in the next line
+            for(int i = (addr+ofs) & 63; ofs < size && i < 64; ++ofs, ++i) {
+                pl->data[i] = (char)val;
+                pl->mask |= 1ULL << i;
+                val >>= 8;
             }
-        }
-        for(int ofs = 0; ofs < size; ++ofs) {
-            pending_writes[addr+ofs] = (char)val;
-            if (DEBUG_WRITES) cerr << "Received pending write for address 0x" << std::hex << (addr+ofs) << " value 0x" << (int)(val) << endl;
-            val >>= 8;
         }
     }
 
 #define ECALL_DEBUG 0
 #define ECALL_MEMGUARD (10*1024)
+#define ECALL_MAX_MEMARGS 4
+
+    // copy of the memory a pointer argument may touch, translated once per page
+    struct MemArg {
+        long long virt;
+        int nchunks;
+        struct { int ofs, len; long long phys; } chunks[ECALL_MEMGUARD/PAGE_SIZE + 2];
+        char data[ECALL_MEMGUARD];
+    };
+
+    static void snapshot_memarg(MemArg& m, long long virt) {
+        m.virt = virt;
+        m.nchunks = 0;
+        for(int ofs = 0; ofs < ECALL_MEMGUARD; ) {
+            long long v = (virt & ~63) + ofs;
+            int len = min((long long)(PAGE_SIZE - (v & (PAGE_SIZE-1))), (long long)(ECALL_MEMGUARD - ofs));
+            long long phys = System::sys->virt_to_phy(v);
+            m.chunks[m.nchunks++] = { ofs, len, phys };
+            memcpy(&m.data[ofs], &System::sys->ram[phys], len);
+            ofs += len;
+        }
+    }
 
     void do_ecall(long long a7, long long a0, long long a1, long long a2, long long a3, long long a4, long long a5, long long a6, long long* a0ret) {
-        vector<pair<long long, char[ECALL_MEMGUARD+63]> > memargs;
+        MemArg memargs[ECALL_MAX_MEMARGS];
+        int nmemargs = 0;
 
         switch(a7) {
 
@@ -73,13 +123,21 @@ extern "C" {
             return;
 
         case __NR_munmap:
+            System::sys->unmap(a0, a1);
+            *a0ret = 0;
+            return;
+
         case __NR_mprotect:
             *a0ret = 0; // assume we succeeded
             return;
 
         case __NR_exit_group:
         case __NR_exit:
+            System::sys->exit_code = a0 & 0xff;
+            Verilated::gotFinish(true);
+            return;
         case __NR_tgkill:
+            System::sys->exit_code = 128 + a2; // as a shell reports death by signal
             Verilated::gotFinish(true);
             return;
 
@@ -97,6 +155,11 @@ extern "C" {
                     *a0ret = a2;
                     System::sys->invalidate(a1 & ~0x63);
                     return;
+                case 3/*SIM_CHECKPOINT*/:
+                    // marker from the guest, the main loop saves once the memory system is drained
+                    System::sys->checkpoint_requested = true;
+                    *a0ret = 0;
+                    return;
                 default:
                     cerr << "Unsupported arch-specific syscall " << a0 << endl;
                     Verilated::gotFinish(true);
@@ -119,12 +182,8 @@ extern "C" {
 
 #define ECALL_OFFSET(v)                                                  \
     do {                                                                 \
-        memargs.resize(memargs.size()+1);                                \
-        memargs.back().first = v;                                        \
-        for(int i = 0; i < ECALL_MEMGUARD; ++i) {                        \
-            long long physptr = System::sys->virt_to_phy((v & ~63) + i); \
-            memargs.back().second[i] = System::sys->ram[physptr];        \
-        }                                                                \
+        assert(nmemargs < ECALL_MAX_MEMARGS);                            \
+        snapshot_memarg(memargs[nmemargs++], v);                         \
         v += (long long)System::sys->ram_virt;                           \
     } while(0)
 
@@ -388,15 +447,16 @@ extern "C" {
             if (ECALL_DEBUG) cerr << "Default syscall " << std::dec << a7 << endl;
             break;
         }
-        for(auto& m : memargs)
-            for(int i = 0; i < ECALL_MEMGUARD; ++i) {
-                long long physptr = System::sys->virt_to_phy((m.first & ~63) + i);
-                auto pw = pending_writes.find(physptr);
-                if (pw == pending_writes.end()) continue;
-                if (DEBUG_WRITES) cerr << "Merging in pending write for address 0x" << std::hex << pw->first << " value 0x" << (int)(pw->second) << endl;
-                System::sys->ram[pw->first] = pw->second;
-                pending_writes.erase(pw);
-            }
+        if (!pending_writes.empty())
+            for(int a = 0; a < nmemargs; ++a)
+                for(int c = 0; c < memargs[a].nchunks; ++c)
+                    for(int i = 0; i < memargs[a].chunks[c].len; i += 64) {
+                        long long physptr = memargs[a].chunks[c].phys + i;
+                        PendingLine* pl = pending_writes.find(physptr);
+                        if (!pl) continue;
+                        merge_line(physptr, *pl);
+                        pending_writes.erase(pl);
+                    }
         if (ECALL_DEBUG) cerr << "Calling syscall " << std::dec << a7;
 
         iovec* iov = (iovec*)a1;
@@ -416,17 +476,33 @@ extern "C" {
                 iov[i].iov_base = (char*)iov[i].iov_base - (long long)System::sys->ram_virt;
 
         if (ECALL_DEBUG) cerr << " => " << std::dec << *a0ret << endl;
-        set<long long> invalidations;
-        for(auto& m : memargs)
-            for(int i = 0; i < ECALL_MEMGUARD; ++i) {
-                long long physptr = System::sys->virt_to_phy((m.first & ~63) + i);
-                if (m.second[i] != System::sys->ram[physptr]) {
-                    if (ECALL_DEBUG) cerr << "Invalidating " << std::dec << i << " on argument " << std::hex << physptr << "/" << m.first << "/" << System::sys->ram[physptr] << endl;
-                    invalidations.insert(physptr & ~63);
+        // invalidate the lines the syscall changed (invalidate() drops duplicates)
+        for(int a = 0; a < nmemargs; ++a) {
+            MemArg& m = memargs[a];
+            for(int c = 0; c < m.nchunks; ++c)
+                for(int i = 0; i < m.chunks[c].len; i += 64) {
+                    long long physptr = m.chunks[c].phys + i;
+                    if (!memcmp(&m.data[m.chunks[c].ofs + i], &System::sys->ram[physptr], 64)) continue;
+                    if (ECALL_DEBUG) cerr << "Invalidating " << std::dec << (m.chunks[c].ofs + i) << " on argument " << std::hex << physptr << "/" << m.virt << endl;
+                    System::sys->invalidate(physptr);
                 }
-            }
-        for(auto& i : invalidations)
-            System::sys->invalidate(i);
+        }
+    }
+
+}
+
+void drop_pending_writes(uint64_t phys_addr, uint64_t len) {
+    if (pending_writes.empty()) return;
+    for(uint64_t line = phys_addr & ~63ULL; line < phys_addr + len; line += 64) {
+        PendingLine* pl = pending_writes.find(line);
+        if (pl) pending_writes.erase(pl);
     }
+}
+
+void save_pending_writes(ostream& os) {
+    os.write((const char*)&pending_writes, sizeof(pending_writes));
+}
 
+void restore_pending_writes(istream& is) {
+    is.read((char*)&pending_writes, sizeof(pending_writes));
 }
@@ -14,6 +14,9 @@ void rtc_tick(Vtop* top) {
     --ticks_to_timer;
 }
 
+uint64_t rtc_get_state() { return ticks_to_timer; }
+void rtc_set_state(uint64_t state) { ticks_to_timer = state; }
+
 void write_one(const Device* self, Vtop* top) {
     System::sys->w_addr = top->m_axi_awaddr;
     System::sys->w_count = 1;
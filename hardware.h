@@ -4,6 +4,8 @@
 #include "Vtop.h"
 
 void rtc_tick(Vtop* top);
+uint64_t rtc_get_state();
+void rtc_set_state(uint64_t state);
 
 struct Device {
   uint64_t start, size;
@@ -32,7 +32,10 @@ module ICache #(
     output logic                  m_axi_rready,
 
     input  logic                  flush,  
-    input  logic                  stall   
+    input  logic                  stall,
+
+    output logic                  miss_out,      // a refill starts this cycle
+    output logic                  refilling_out  // a refill is in progress
 );
 
     typedef struct packed {
@@ -44,8 +47,9 @@ module ICache #(
     cache_line_t cache [0:NUMBER_OF_SETS-1][0:NUMBER_OF_WAYS-1];
 
     logic lru [0:NUMBER_OF_SETS-1];
+    logic [63:0] warm_addr;
 
-    localparam INDEX_BITS = 9; 
+    localparam INDEX_BITS = $clog2(NUMBER_OF_SETS);
     localparam OFFSET_BITS = 6; 
     localparam TAG_BITS = ADDR_WIDTH - OFFSET_BITS - INDEX_BITS; 
     logic [OFFSET_BITS-1:0]  offset; 
@@ -171,6 +175,9 @@ module ICache #(
         endcase
     end
 
+    assign miss_out      = next_state == MISS && current_state != MISS;
+    assign refilling_out = current_state == MISS || current_state == REFILL || current_state == COPY;
+
     always_ff @(posedge clk or posedge reset) begin
         if (reset) begin
             current_state <= IDLE;
@@ -181,9 +188,13 @@ module ICache #(
             for (int i = 0; i < NUMBER_OF_SETS; i++) begin
                 lru[i] = 1'b0;
                 for (int j = 0; j < NUMBER_OF_WAYS; j++) begin
-                    cache[i][j].valid = 1'b0;
-                    cache[i][j].tag   = '0;
-                    cache[i][j].data  = '0;
+                    // preload the lines the fast-forward ISS left in this set, if any
+                    warm_addr = cache_warm_line(0, i, j);
+                    cache[i][j].valid = (warm_addr != '1);
+                    cache[i][j].tag   = warm_addr[ADDR_WIDTH-1 -: TAG_BITS];
+                    for (int k = 0; k < CACHE_LINE_SIZE/64; k++) begin
+                        cache[i][j].data[k*64 +: 64] = (warm_addr != '1) ? cache_warm_data(warm_addr + k*8) : '0;
+                    end
                 end
             end
         end else begin
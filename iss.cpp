@@ -0,0 +1,303 @@
+#include <iostream>
+#include <string.h>
+#include <assert.h>
+#include "iss.h"
+
+using namespace std;
+
+enum {
+    LUI, AUIPC, JAL, JALR,
+    BEQ, BNE, BLT, BGE, BLTU, BGEU,
+    LB, LH, LW, LD, LBU, LHU, LWU,
+    SB, SH, SW, SD,
+    ADDI, SLTI, SLTIU, XORI, ORI, ANDI, SLLI, SRLI, SRAI,
+    ADD, SUB, SLL, SLT, SLTU, XOR, SRL, SRA, OR, AND,
+    MUL, MULH, MULHSU, MULHU, DIV, DIVU, REM, REMU,
+    ADDIW, SLLIW, SRLIW, SRAIW,
+    ADDW, SUBW, SLLW, SRLW, SRAW,
+    MULW, DIVW, DIVUW, REMW, REMUW,
+    FENCE, FENCE_I, ECALL, UNSUPPORTED
+};
+
+// the Iss whose state the core picks up at reset, see handoff()
+static Iss* handoff_iss = NULL;
+
+WarmCache::WarmCache(unsigned sets)
+    : sets(sets), lines(sets*WARM_WAYS, ~0ULL), lru(sets, false)
+{
+}
+
+void WarmCache::access(uint64_t addr) {
+    uint64_t line = addr & ~(uint64_t)(WARM_LINE-1);
+    unsigned set_no = (addr / WARM_LINE) % sets;
+    uint64_t* set = &lines[set_no * WARM_WAYS];
+    if (set[0] == line) { lru[set_no] = 1; return; }
+    if (set[1] == line) { lru[set_no] = 0; return; }
+    set[lru[set_no]] = line;
+    lru[set_no] = !lru[set_no];
+}
+
+Iss::Iss(System* sys, Vtop* top, bool warm)
+    : sys(sys), top(top), pc(top->entry), instret(0), stopped(false), icache(NULL), dcache(NULL), bbv(NULL)
+{
+    assert(!sys->full_system); // relies on fake-os for system calls
+    memset(x, 0, sizeof(x));
+    x[2] = top->stackptr;
+    if (warm) {
+        icache = new WarmCache(ICACHE_SETS);
+        dcache = new WarmCache(DCACHE_SETS);
+    }
+    sys->fast_forwarding = true;
+}
+
+Iss::~Iss() {
+    if (handoff_iss == this) handoff_iss = NULL;
+    sys->fast_forwarding = false;
+    delete icache;
+    delete dcache;
+}
+
+template<typename T> T Iss::load(uint64_t addr) {
+    if (dcache) dcache->access(addr);
+    return *(T*)&sys->ram[sys->virt_to_phy(addr)];
+}
+
+template<typename T> void Iss::store(uint64_t addr, T val) {
+    if (dcache) dcache->access(addr);
+    *(T*)&sys->ram[sys->virt_to_phy(addr)] = val;
+}
+
+Iss::Block& Iss::decode_block(uint64_t block_pc) {
+    Block& b = blocks[block_pc];
+    for(uint64_t ipc = block_pc; b.insts.size() < ISS_MAX_BLOCK; ipc += 4) {
+        uint32_t inst = *(uint32_t*)&sys->ram[sys->virt_to_phy(ipc)];
+        uint32_t opcode = inst & 0x7f, f3 = (inst >> 12) & 7, f7 = inst >> 25;
+        int32_t imm_i = (int32_t)inst >> 20;
+        int32_t imm_s = (((int32_t)inst >> 25) << 5) | ((inst >> 7) & 0x1f);
+        int32_t imm_b = (((int32_t)inst >> 31) << 12) | (((inst >> 7) & 1) << 11) | (((inst >> 25) & 0x3f) << 5) | (((inst >> 8) & 0xf) << 1);
+        int32_t imm_u = (int32_t)(inst & 0xfffff000);
+        int32_t imm_j = (((int32_t)inst >> 31) << 20) | (inst & 0xff000) | (((inst >> 20) & 1) << 11) | (((inst >> 21) & 0x3ff) << 1);
+        Inst in = { UNSUPPORTED, (uint8_t)((inst >> 7) & 0x1f), (uint8_t)((inst >> 15) & 0x1f), (uint8_t)((inst >> 20) & 0x1f), imm_i };
+        switch(opcode) {
+            case 0x37: in.op = LUI; in.imm = imm_u; break;
+            case 0x17: in.op = AUIPC; in.imm = imm_u; break;
+            case 0x6f: in.op = JAL; in.imm = imm_j; break;
+            case 0x67: if (f3 == 0) in.op = JALR; break;
+            case 0x63: {
+                static const uint8_t ops[8] = { BEQ, BNE, UNSUPPORTED, UNSUPPORTED, BLT, BGE, BLTU, BGEU };
+                in.op = ops[f3];
+                in.imm = imm_b;
+                break;
+            }
+            case 0x03: {
+                static const uint8_t ops[8] = { LB, LH, LW, LD, LBU, LHU, LWU, UNSUPPORTED };
+                in.op = ops[f3];
+                break;
+            }
+            case 0x23: {
+                static const uint8_t ops[8] = { SB, SH, SW, SD, UNSUPPORTED, UNSUPPORTED, UNSUPPORTED, UNSUPPORTED };
+                in.op = ops[f3];
+                in.imm = imm_s;
+                break;
+            }
+            case 0x13: {
+                static const uint8_t ops[8] = { ADDI, SLLI, SLTI, SLTIU, XORI, SRLI, ORI, ANDI };
+                in.op = ops[f3];
+                if (f3 == 5 && (f7 >> 1) == 0x10) in.op = SRAI;
+                if (f3 == 1 || f3 == 5) in.imm &= 0x3f;
+                break;
+            }
+            case 0x1b:
+                if (f3 == 0) in.op = ADDIW;
+                else if (f3 == 1) in.op = SLLIW;
+                else if (f3 == 5) in.op = (f7 == 0x20) ? SRAIW : SRLIW;
+                if (f3 == 1 || f3 == 5) in.imm &= 0x1f;
+                break;
+            case 0x33:
+                if (f7 == 0x01) {
+                    static const uint8_t ops[8] = { MUL, MULH, MULHSU, MULHU, DIV, DIVU, REM, REMU };
+                    in.op = ops[f3];
+                } else if (f7 == 0x00) {
+                    static const uint8_t ops[8] = { ADD, SLL, SLT, SLTU, XOR, SRL, OR, AND };
+                    in.op = ops[f3];
+                } else if (f7 == 0x20) {
+                    if (f3 == 0) in.op = SUB;
+                    else if (f3 == 5) in.op = SRA;
+                }
+                break;
+            case 0x3b:
+                if (f7 == 0x01) {
+                    static const uint8_t ops[8] = { MULW, UNSUPPORTED, UNSUPPORTED, UNSUPPORTED, DIVW, DIVUW, REMW, REMUW };
+                    in.op = ops[f3];
+                } else if (f7 == 0x00) {
+                    if (f3 == 0) in.op = ADDW;
+                    else if (f3 == 1) in.op = SLLW;
+                    else if (f3 == 5) in.op = SRLW;
+                } else if (f7 == 0x20) {
+                    if (f3 == 0) in.op = SUBW;
+                    else if (f3 == 5) in.op = SRAW;
+                }
+                break;
+            case 0x0f: in.op = (f3 == 1) ? FENCE_I : FENCE; break;
+            case 0x73: if (inst == 0x00000073) in.op = ECALL; break;
+        }
+        b.insts.push_back(in);
+        if ((in.op >= JAL && in.op <= BGEU) || in.op >= FENCE_I) break; // control flow, ecall or unsupported ends the block
+    }
+    return b;
+}
+
+void Iss::run(uint64_t max_insts) {
+    uint64_t end = instret + max_insts;
+    while(instret < end && !stopped) {
+        auto cached = blocks.find(pc);
+        Block& b = (cached != blocks.end()) ? cached->second : decode_block(pc);
+        size_t n = b.insts.size();
+        if (n > end - instret) n = end - instret;
+        uint64_t block_pc = pc, block_start = instret;
+
+        uint64_t ipc = pc;
+        for(size_t i = 0; i < n; ++i) {
+            const Inst& in = b.insts[i];
+            uint64_t rs1 = x[in.rs1], rs2 = x[in.rs2];
+            uint64_t& rd = x[in.rd];
+            uint64_t imm = (int64_t)in.imm;
+            uint64_t next = ipc + 4;
+            if (icache) icache->access(ipc);
+            switch(in.op) {
+                case LUI:    rd = imm; break;
+                case AUIPC:  rd = ipc + imm; break;
+                case JAL:    rd = next; next = ipc + imm; break;
+                case JALR:   rd = next; next = (rs1 + imm) & ~1ULL; break;
+                case BEQ:    if (rs1 == rs2) next = ipc + imm; break;
+                case BNE:    if (rs1 != rs2) next = ipc + imm; break;
+                case BLT:    if ((int64_t)rs1 < (int64_t)rs2) next = ipc + imm; break;
+                case BGE:    if ((int64_t)rs1 >= (int64_t)rs2) next = ipc + imm; break;
+                case BLTU:   if (rs1 < rs2) next = ipc + imm; break;
+                case BGEU:   if (rs1 >= rs2) next = ipc + imm; break;
+                case LB:     rd = load<int8_t>(rs1 + imm); break;
+                case LH:     rd = load<int16_t>(rs1 + imm); break;
+                case LW:     rd = load<int32_t>(rs1 + imm); break;
+                case LD:     rd = load<uint64_t>(rs1 + imm); break;
+                case LBU:    rd = load<uint8_t>(rs1 + imm); break;
+                case LHU:    rd = load<uint16_t>(rs1 + imm); break;
+                case LWU:    rd = load<uint32_t>(rs1 + imm); break;
+                case SB:     store<uint8_t>(rs1 + imm, rs2); break;
+                case SH:     store<uint16_t>(rs1 + imm, rs2); break;
+                case SW:     store<uint32_t>(rs1 + imm, rs2); break;
+                case SD:     store<uint64_t>(rs1 + imm, rs2); break;
+                case ADDI:   rd = rs1 + imm; break;
+                case SLTI:   rd = (int64_t)rs1 < (int64_t)imm; break;
+                case SLTIU:  rd = rs1 < imm; break;
+                case XORI:   rd = rs1 ^ imm; break;
+                case ORI:    rd = rs1 | imm; break;
+                case ANDI:   rd = rs1 & imm; break;
+                case SLLI:   rd = rs1 << imm; break;
+                case SRLI:   rd = rs1 >> imm; break;
+                case SRAI:   rd = (int64_t)rs1 >> imm; break;
+                case ADD:    rd = rs1 + rs2; break;
+                case SUB:    rd = rs1 - rs2; break;
+                case SLL:    rd = rs1 << (rs2 & 0x3f); break;
+                case SLT:    rd = (int64_t)rs1 < (int64_t)rs2; break;
+                case SLTU:   rd = rs1 < rs2; break;
+                case XOR:    rd = rs1 ^ rs2; break;
+                case SRL:    rd = rs1 >> (rs2 & 0x3f); break;
+                case SRA:    rd = (int64_t)rs1 >> (rs2 & 0x3f); break;
+                case OR:     rd = rs1 | rs2; break;
+                case AND:    rd = rs1 & rs2; break;
+                case MUL:    rd = rs1 * rs2; break;
+                case MULH:   rd = ((__int128)(int64_t)rs1 * (__int128)(int64_t)rs2) >> 64; break;
+                case MULHSU: rd = ((__int128)(int64_t)rs1 * (__int128)rs2) >> 64; break;
+                case MULHU:  rd = ((unsigned __int128)rs1 * rs2) >> 64; break;
+                case DIV:
+                    if (!rs2) rd = ~0ULL;
+                    else if ((int64_t)rs1 == INT64_MIN && (int64_t)rs2 == -1) rd = rs1;
+                    else rd = (int64_t)rs1 / (int64_t)rs2;
+                    break;
+                case DIVU:   rd = rs2 ? rs1 / rs2 : ~0ULL; break;
+                case REM:
+                    if (!rs2) rd = rs1;
+                    else if ((int64_t)rs1 == INT64_MIN && (int64_t)rs2 == -1) rd = 0;
+                    else rd = (int64_t)rs1 % (int64_t)rs2;
+                    break;
+                case REMU:   rd = rs2 ? rs1 % rs2 : rs1; break;
+                case ADDIW:  rd = (int32_t)(rs1 + imm); break;
+                case SLLIW:  rd = (int32_t)((uint32_t)rs1 << imm); break;
+                case SRLIW:  rd = (int32_t)((uint32_t)rs1 >> imm); break;
+                case SRAIW:  rd = (int32_t)rs1 >> imm; break;
+                case ADDW:   rd = (int32_t)(rs1 + rs2); break;
+                case SUBW:   rd = (int32_t)(rs1 - rs2); break;
+                case SLLW:   rd = (int32_t)((uint32_t)rs1 << (rs2 & 0x1f)); break;
+                case SRLW:   rd = (int32_t)((uint32_t)rs1 >> (rs2 & 0x1f)); break;
+                case SRAW:   rd = (int32_t)rs1 >> (rs2 & 0x1f); break;
+                case MULW:   rd = (int32_t)(rs1 * rs2); break;
+                case DIVW:
+                    if (!(int32_t)rs2) rd = ~0ULL;
+                    else if ((int32_t)rs1 == INT32_MIN && (int32_t)rs2 == -1) rd = (int32_t)rs1;
+                    else rd = (int32_t)rs1 / (int32_t)rs2;
+                    break;
+                case DIVUW:  rd = (uint32_t)rs2 ? (int32_t)((uint32_t)rs1 / (uint32_t)rs2) : ~0ULL; break;
+                case REMW:
+                    if (!(int32_t)rs2) rd = (int32_t)rs1;
+                    else if ((int32_t)rs1 == INT32_MIN && (int32_t)rs2 == -1) rd = 0;
+                    else rd = (int32_t)rs1 % (int32_t)rs2;
+                    break;
+                case REMUW:  rd = (uint32_t)rs2 ? (int32_t)((uint32_t)rs1 % (uint32_t)rs2) : (int32_t)rs1; break;
+                case FENCE:  break;
+                case FENCE_I:
+                    // code may have changed, drop every predecoded block (including this one)
+                    x[0] = 0;
+                    instret += i + 1;
+                    pc = next;
+                    blocks.clear();
+                    goto next_block;
+                case ECALL: {
+                    long long ret;
+                    do_ecall(x[17], x[10], x[11], x[12], x[13], x[14], x[15], x[16], &ret);
+                    x[10] = ret;
+                    if (Verilated::gotFinish()) stopped = true;
+                    break;
+                }
+                default:
+                    // hand this instruction to the core
+                    x[0] = 0;
+                    instret += i;
+                    pc = ipc;
+                    stopped = true;
+                    goto next_block;
+            }
+            x[0] = 0;
+            ipc = next;
+        }
+        instret += n;
+        pc = ipc;
+next_block:
+        if (bbv) (*bbv)[block_pc] += instret - block_start;
+    }
+}
+
+// The core picks up the state at its next reset: PC through top->entry,
+// registers and preloaded cache lines through the DPI calls below.
+void Iss::handoff() {
+    top->entry = pc;
+    handoff_iss = this;
+    sys->fast_forwarding = false;
+}
+
+extern "C" {
+
+    long long initial_reg(int idx, long long dflt) {
+        return handoff_iss ? handoff_iss->x[idx] : dflt;
+    }
+
+    long long cache_warm_line(int cache, int set, int way) {
+        WarmCache* wc = !handoff_iss ? NULL : cache ? handoff_iss->dcache : handoff_iss->icache;
+        if (!wc || set >= (int)wc->sets || way >= WARM_WAYS) return -1;
+        return wc->lines[set*WARM_WAYS + way];
+    }
+
+    long long cache_warm_data(long long addr) {
+        return *(uint64_t*)&System::sys->ram[System::sys->virt_to_phy(addr)];
+    }
+
+}
@@ -0,0 +1,68 @@
+#ifndef __ISS_H
+#define __ISS_H
+
+#include <unordered_map>
+#include <vector>
+#include "system.h"
+
+#define ISS_MAX_BLOCK   (64)    // instructions per predecoded block
+
+// geometry of the core's ICache/DCache, modelled by the ISS when warming them; the Makefile
+// passes the set counts it verilated the core with
+#ifndef ICACHE_SETS
+#define ICACHE_SETS     (512)
+#endif
+#ifndef DCACHE_SETS
+#define DCACHE_SETS     (512)
+#endif
+#define WARM_WAYS       (2)
+#define WARM_LINE       (64)
+
+// Tag-only model of one of the core's caches, used to preload it at the handoff
+struct WarmCache {
+    unsigned sets;
+    std::vector<uint64_t> lines; // line address of [set*WARM_WAYS + way], ~0 when invalid
+    std::vector<bool> lru;       // way to replace next, same policy as the RTL
+
+    WarmCache(unsigned sets);
+    void access(uint64_t addr);
+};
+
+// Functional RV64IM simulator for fast-forwarding a guest before detailed simulation.
+// Shares guest memory and syscall emulation with the Verilated core.
+class Iss {
+public:
+    struct Inst {
+        uint8_t op, rd, rs1, rs2;
+        int32_t imm;
+    };
+    struct Block {
+        std::vector<Inst> insts; // ends at the first control-flow instruction, ecall or unsupported instruction
+    };
+
+private:
+    System* sys;
+    Vtop* top;
+    std::unordered_map<uint64_t, Block> blocks;
+
+    Block& decode_block(uint64_t block_pc);
+    template<typename T> T load(uint64_t addr);
+    template<typename T> void store(uint64_t addr, T val);
+
+public:
+    uint64_t pc;
+    uint64_t x[32];
+    uint64_t instret;
+    bool stopped; // guest exited, or reached an instruction only the core can run
+    WarmCache* icache; // NULL unless warming the core's caches
+    WarmCache* dcache;
+    std::unordered_map<uint64_t, uint64_t>* bbv; // if set, instructions executed per block start PC
+
+    Iss(System* sys, Vtop* top, bool warm);
+    ~Iss();
+
+    void run(uint64_t max_insts);
+    void handoff();
+};
+
+#endif
@@ -1,15 +1,46 @@
 #include <iostream>
 #include <string.h>
+#include <chrono>
+#include <algorithm>
+#include <vector>
+#include <unistd.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#if defined(__x86_64__) || defined(__i386__)
+# include <x86intrin.h>
+# define HOST_CYCLES() __rdtsc()
+#else
+# define HOST_CYCLES() 0ULL
+#endif
 #include "Vtop.h"
 #include "verilated.h"
 #include "system.h"
+#include "iss.h"
+#include "simpoint.h"
+#include "config.h"
+#include "perf.h"
 #if VM_TRACE
 # include <verilated_vcd_c.h>	// Trace file format header
 #endif
 
+// defaults of RAM_SIZE, PS_PER_CLOCK and MAX_CYCLES
 #define RAM_SIZE                  (1*GIGA)
-#define INIT_STACK_OFFSET         (4*MEGA)
-#define INIT_STACK_POINTER        (RAM_SIZE - INIT_STACK_OFFSET)
+#define PS_PER_CLOCK              (500)
+#define MAX_CYCLES                (2000*GIGA)
+
+// host dTLB load misses of this process from now on, or -1 where perf events are unavailable
+static int open_dtlb_miss_counter() {
+	struct perf_event_attr attr;
+	memset(&attr, 0, sizeof(attr));
+	attr.size = sizeof(attr);
+	attr.type = PERF_TYPE_HW_CACHE;
+	attr.config = PERF_COUNT_HW_CACHE_DTLB | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+	attr.exclude_kernel = 1;
+	attr.exclude_hv = 1;
+	attr.inherit = 1; // include the DRAMSim thread
+	return syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+}
 
 /** Current simulation time */
 double sc_time_stamp() {
@@ -18,17 +49,36 @@ double sc_time_stamp() {
 
 int main(int argc, char* argv[]) {
 	Verilated::commandArgs(argc, argv);
+	config_init(argc, argv);
+
+	// the guest's argv: the program path and its arguments, or PROG when none are given
+	std::vector<char*> guest_argv(argv+1, argv+argc);
+	const char* PROG = config_get("PROG");
+	if (guest_argv.empty() && PROG) guest_argv.push_back((char*)PROG);
+	const char* binaryfn = guest_argv.empty() ? NULL : guest_argv[0];
+	uint64_t ramsize = config_number("RAM_SIZE", RAM_SIZE);
+	if (ramsize < 16*MEGA || ramsize > RAM_SIZE || ramsize % (2*MEGA)) {
+		std::cerr << "RAM_SIZE must be a multiple of 2M, from 16M to " << RAM_SIZE/MEGA << "M" << std::endl;
+		return -1;
+	}
+	uint64_t ps_per_clock = config_number("PS_PER_CLOCK", PS_PER_CLOCK);
+	if (!ps_per_clock || ps_per_clock % 2) {
+		std::cerr << "PS_PER_CLOCK must be a positive even number of picoseconds" << std::endl;
+		return -1;
+	}
+	uint64_t max_cycles = config_number("MAX_CYCLES", MAX_CYCLES);
 
-	const char* binaryfn = NULL;
-	if (argc > 0) binaryfn = argv[1];
+	// SIMPOINT=<prefix> estimates CPI from sampled intervals instead of running the whole guest
+	const char* SIMPOINT = config_get("SIMPOINT");
+	if (SIMPOINT) simpoint_run(SIMPOINT);
 
 	Vtop top;
-	System sys(&top, RAM_SIZE, binaryfn, argc-1, argv+1, 500/*ps_per_clock*/);
+	System sys(&top, ramsize, binaryfn, guest_argv.size(), guest_argv.data(), ps_per_clock);
 
   if (!sys.full_system) {
     // (argc, argv) sanity check
     std::cerr << "===== Printing arguments of the program..." << std::endl;
-    for (int j = 0; j <= argc-1; j++) {
+    for (int j = 0; j <= (int)guest_argv.size(); j++) {
       unsigned long guest_addr = top.stackptr + j * sizeof(uint64_t);
       uint64_t val = *(uint64_t *)(sys.ram_virt + guest_addr);
 
@@ -74,28 +124,126 @@ int main(int argc, char* argv[]) {
 		sys.ticks += sys.ps_per_clock/2;   \
 	} while(0)
 
+	// BBV=<file> only profiles the guest on the ISS, one basic-block vector per BBV_INTERVAL instructions
+	const char* BBV = config_get("BBV");
+	if (BBV) {
+		const char* BBV_INTERVAL = config_get("BBV_INTERVAL");
+		simpoint_profile(sys, top, BBV, BBV_INTERVAL ? strtoull(BBV_INTERVAL, NULL, 0) : SIMPOINT_INTERVAL);
+		return 0;
+	}
+
+	// FASTFORWARD=<n> runs the first n instructions on the functional ISS, then hands the
+	// state to the core at reset; FF_WARM=y also preloads its caches with the lines the ISS touched
+	Iss* iss = NULL;
+	const char* FASTFORWARD = config_get("FASTFORWARD");
+	if (FASTFORWARD) {
+		iss = new Iss(&sys, &top, config_flag("FF_WARM"));
+		std::chrono::steady_clock::time_point ff_start = std::chrono::steady_clock::now();
+		iss->run(strtoull(FASTFORWARD, NULL, 0));
+		double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - ff_start).count();
+		std::cerr << std::dec << "== Fast-forwarded " << iss->instret << " instructions in " << secs << " s: "
+		          << (iss->instret/secs/1e6) << " MIPS, continuing at pc 0x" << std::hex << iss->pc << std::endl;
+		iss->handoff();
+	}
+
 	top.reset = 1;
 	top.clk = 0;
+	top.skipped = 0;
 	TICK(); // 1
 	TICK(); // 0
 	TICK(); // 1
 	TICK(); // 0
 	TICK(); // 1
 	top.reset = 0;
+	delete iss;
+
+	// RESTORE=<file> resumes from a checkpoint; CHECKPOINT=<file> saves one at CHECKPOINT_CYCLE,
+	// CHECKPOINT_INSTRET or the guest's marker ecall, and CHECKPOINT_EXIT=y stops right after
+	const char* RESTORE = config_get("RESTORE");
+	if (RESTORE) sys.restore_checkpoint(RESTORE);
+	const char* CHECKPOINT = config_get("CHECKPOINT");
+	const char* CHECKPOINT_CYCLE = config_get("CHECKPOINT_CYCLE");
+	const char* CHECKPOINT_INSTRET = config_get("CHECKPOINT_INSTRET");
+	uint64_t checkpoint_cycle = CHECKPOINT_CYCLE ? strtoull(CHECKPOINT_CYCLE, NULL, 0) : ~0ULL;
+	uint64_t checkpoint_instret = CHECKPOINT_INSTRET ? strtoull(CHECKPOINT_INSTRET, NULL, 0) : ~0ULL;
+	bool checkpoint_exit = config_flag("CHECKPOINT_EXIT");
 
-	const char* SHOWCONSOLE = getenv("SHOWCONSOLE");
+	const char* SHOWCONSOLE = config_get("SHOWCONSOLE");
 	if (SHOWCONSOLE?(atoi(SHOWCONSOLE)!=0):0) sys.console();
 
-	while (sys.ticks/sys.ps_per_clock < 2000*GIGA && !Verilated::gotFinish()) {
+	// SKIP_STALLS=y advances cycles without evaluating the core while it is blocked on a read
+	bool skip_stalls = config_flag("SKIP_STALLS");
+#if VM_TRACE
+	if (tfp) skip_stalls = false; // keep the trace complete
+#endif
+
+	// BENCH=y reports host cost per simulated cycle and simulated KIPS of the main loop
+	bool bench = config_flag("BENCH");
+	struct rusage start_usage;
+	getrusage(RUSAGE_SELF, &start_usage);
+	int dtlb_fd = bench ? open_dtlb_miss_counter() : -1;
+	uint64_t start_ticks = sys.ticks;
+	uint64_t start_instret = top.instret;
+	unsigned long long start_host_cycles = HOST_CYCLES();
+	std::chrono::steady_clock::time_point start_time = std::chrono::steady_clock::now();
+
+	while (sys.ticks/sys.ps_per_clock < max_cycles && !Verilated::gotFinish()) {
 		TICK();
+		if (skip_stalls && top.clk) {
+			// the performance counters account for the skipped cycles at the next rising edge
+			uint64_t skipped_before = sys.skipped_cycles;
+			if (sys.can_skip())
+				while (sys.ticks/sys.ps_per_clock < std::min(checkpoint_cycle, max_cycles) && sys.skip_cycle()) {}
+			top.skipped = sys.skipped_cycles - skipped_before;
+		}
+		if (CHECKPOINT && top.clk
+		    && (sys.checkpoint_requested || sys.ticks/sys.ps_per_clock >= checkpoint_cycle || top.instret >= checkpoint_instret)
+		    && sys.checkpoint_drained()) {
+			sys.save_checkpoint(CHECKPOINT);
+			sys.checkpoint_requested = false;
+			checkpoint_cycle = checkpoint_instret = ~0ULL;
+			if (checkpoint_exit) break;
+		}
+		if (simpoint_sample && simpoint_sample->retired(top.instret, sys.ticks/sys.ps_per_clock)) break;
+	}
+	if (simpoint_sample) simpoint_sample->report(top.instret, sys.ticks/sys.ps_per_clock);
+
+	top.final(); // reports the performance counters
+
+	if (bench) {
+		double sim_cycles = (double)(sys.ticks - start_ticks) / sys.ps_per_clock;
+		double host_cycles = (double)(HOST_CYCLES() - start_host_cycles);
+		double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start_time).count();
+		uint64_t insts = top.instret - start_instret;
+		std::cerr << std::dec << "== Simulated " << (uint64_t)sim_cycles << " cycles in " << secs << " s: "
+		          << (secs*1e9/sim_cycles) << " ns, " << (host_cycles/sim_cycles) << " host cycles per simulated cycle" << std::endl;
+		std::cerr << std::dec << "== Retired " << insts << " instructions: " << (insts/secs/1000) << " KIPS" << std::endl;
+		struct rusage usage;
+		getrusage(RUSAGE_SELF, &usage);
+		std::cerr << std::dec << "== Host page faults: " << (usage.ru_minflt - start_usage.ru_minflt) << " minor, "
+		          << (usage.ru_majflt - start_usage.ru_majflt) << " major";
+		uint64_t dtlb_misses;
+		if (dtlb_fd != -1 && read(dtlb_fd, &dtlb_misses, sizeof(dtlb_misses)) == sizeof(dtlb_misses))
+			std::cerr << ", host dTLB misses: " << dtlb_misses << " (" << (dtlb_misses/sim_cycles) << " per simulated cycle)";
+		std::cerr << std::endl;
+		sys.print_memory_stats(std::cerr);
+		if (skip_stalls)
+			std::cerr << std::dec << "== Skipped " << sys.skipped_cycles << " cycles blocked on memory ("
+			          << (100.0*sys.skipped_cycles/sim_cycles) << "%)" << std::endl;
+		if (sys.use_virtual_memory)
+			std::cerr << std::dec << "== virt_to_phy TLB: " << sys.tlb_hits << " hits, " << sys.tlb_misses << " misses" << std::endl;
+		perf_print_cpi_stack(std::cerr);
+		perf_print_branch_prediction(std::cerr);
 	}
 
-	top.final();
+	// PERF_JSON=<file> writes the core's performance counters and CPI stack
+	const char* PERF_JSON = config_get("PERF_JSON");
+	if (PERF_JSON && *PERF_JSON) perf_write_json(PERF_JSON, sys.ticks/sys.ps_per_clock, sys.skipped_cycles);
 
 #if VM_TRACE
 	if (tfp) tfp->close();
 	delete tfp;
 #endif
 
-	return 0;
+	return sys.exit_code;
 }
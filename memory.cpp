@@ -0,0 +1,213 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <string.h>
+#include <iostream>
+#include <iomanip>
+#include "memory.h"
+#include "config.h"
+
+using namespace std;
+
+MemoryBackend* MemoryBackend::create(const Complete& complete, uint64_t ramsize, int ps_per_clock) {
+    const char* MEMORY = config_get("MEMORY");
+    if (!MEMORY || !strcmp(MEMORY, "dramsim")) {
+        // DRAMSIM_RESULTS names its directory under dramsim2/results
+        const char* DRAMSIM_RESULTS = config_get("DRAMSIM_RESULTS");
+        const char* DRAMSIM_DEVICE = config_get("DRAMSIM_DEVICE");
+        const char* DRAMSIM_SYSTEM = config_get("DRAMSIM_SYSTEM");
+        bool threaded = config_flag("DRAMSIM_THREAD");
+        return new DramSimMemory(complete, ramsize, ps_per_clock, DRAMSIM_DEVICE ? DRAMSIM_DEVICE : "DDR2_micron_16M_8b_x8_sg3E.ini",
+                                 DRAMSIM_SYSTEM ? DRAMSIM_SYSTEM : "system.ini", DRAMSIM_RESULTS ? DRAMSIM_RESULTS : "dram_result", threaded);
+    }
+    if (!strcmp(MEMORY, "fixed")) {
+        const char* MEMORY_LATENCY = config_get("MEMORY_LATENCY");
+        const char* MEMORY_BANDWIDTH = config_get("MEMORY_BANDWIDTH");
+        return new FixedMemory(complete, ps_per_clock, MEMORY_LATENCY ? atof(MEMORY_LATENCY) : 50,
+                               MEMORY_BANDWIDTH ? atof(MEMORY_BANDWIDTH) : 6.4);
+    }
+    if (!strcmp(MEMORY, "perfect")) return new PerfectMemory(complete);
+    cerr << "Unknown MEMORY=" << MEMORY << ", use dramsim, fixed or perfect" << endl;
+    exit(-1);
+}
+
+void PerfectMemory::finish_update() {
+    while(!added.empty()) {
+        complete(added.front().is_write, added.front().address);
+        added.pop_front();
+    }
+}
+
+FixedMemory::FixedMemory(const Complete& complete, int ps_per_clock, double latency_ns, double bandwidth_gbps)
+    : complete(complete), now_ps(0), channel_free_ps(0), ps_per_clock(ps_per_clock), transactions(0)
+{
+    if (latency_ns < 0 || bandwidth_gbps <= 0) {
+        cerr << "MEMORY_LATENCY must be >= 0 ns and MEMORY_BANDWIDTH > 0 GB/s" << endl;
+        exit(-1);
+    }
+    latency_ps = latency_ns * 1000;
+    burst_ps = 64 * 1000 / bandwidth_gbps; // 1 GB/s moves a byte per ns
+}
+
+void FixedMemory::add(bool is_write, uint64_t address) {
+    // transactions queue for the channel; the latency starts when the burst has been transferred
+    uint64_t start_ps = max(now_ps, channel_free_ps);
+    channel_free_ps = start_ps + burst_ps;
+    ++transactions;
+    pending.push_back(Transaction{is_write, address, channel_free_ps + latency_ps});
+}
+
+void FixedMemory::finish_update() {
+    now_ps += ps_per_clock;
+    while(!pending.empty() && pending.front().done_ps <= now_ps) {
+        complete(pending.front().is_write, pending.front().address);
+        pending.pop_front();
+    }
+}
+
+void FixedMemory::restart() {
+    now_ps = channel_free_ps = 0;
+}
+
+void FixedMemory::print_stats(ostream& os, uint64_t cycles) {
+    os << std::dec << "== Memory: " << transactions << " transactions, "
+       << fixed << setprecision(1) << (cycles ? 100.0*transactions*burst_ps/(cycles*ps_per_clock) : 0.0)
+       << "% channel utilization" << defaultfloat << endl;
+}
+
+DramSimMemory::DramSimMemory(const Complete& complete, uint64_t ramsize, int ps_per_clock, const char* device_ini, const char* system_ini, const char* results, bool threaded)
+    : complete(complete), outstanding(0), idle_cycles(0), cycle(0), ps_per_clock(ps_per_clock), cmds_posted(0), cmds_done(0)
+{
+    dramsim = DRAMSim::getMemorySystemInstance(device_ini, system_ini, "../dramsim2", results, ramsize / (1024*1024));
+    unsigned num_chans = 1, bl = 4;
+    float tck = 3.0;
+    dramsim->getIniUint("NUM_CHANS", &num_chans);
+    dramsim->getIniUint("BL", &bl);
+    dramsim->getIniFloat("tCK", &tck);
+    channels.assign(num_chans, ChannelStats{0, 0, 0});
+    burst_ns = bl/2 * tck; // DDR: two beats per clock
+    DRAMSim::TransactionCompleteCB *read_cb = new DRAMSim::Callback<DramSimMemory, void, unsigned, uint64_t, uint64_t>(this, threaded ? &DramSimMemory::read_queued : &DramSimMemory::read_complete);
+    DRAMSim::TransactionCompleteCB *write_cb = new DRAMSim::Callback<DramSimMemory, void, unsigned, uint64_t, uint64_t>(this, threaded ? &DramSimMemory::write_queued : &DramSimMemory::write_complete);
+    dramsim->RegisterCallbacks(read_cb, write_cb, NULL);
+    dramsim->setCPUClockSpeed(1000ULL*1000*1000*1000/ps_per_clock);
+    if (threaded) thread = std::thread(&DramSimMemory::thread_main, this);
+}
+
+DramSimMemory::~DramSimMemory() {
+    if (thread.joinable()) {
+        post(Command{Command::STOP, false, 0});
+        thread.join();
+    }
+}
+
+bool DramSimMemory::will_accept(uint64_t address) {
+    catch_up();
+    wait();
+    return dramsim->willAcceptTransaction(address);
+}
+
+void DramSimMemory::start_update() {
+    ++cycle;
+    // Idle fast path: with no transaction outstanding nothing can complete this cycle,
+    // so defer the update and replay it before the next transaction is handed to DRAMSim.
+    if (!outstanding) ++idle_cycles;
+    else if (thread.joinable()) post(Command{Command::UPDATE, false, 1});
+    else dramsim->update();
+}
+
+void DramSimMemory::finish_update() {
+    if (!thread.joinable()) return;
+    wait();
+    Completion c;
+    while(done.pop(c)) completed(c.channel, c.is_write, c.address);
+}
+
+void DramSimMemory::catch_up() {
+    if (!idle_cycles) return;
+    // replay the deferred updates back-to-back, so DRAMSim sees exactly the same sequence of calls
+    if (thread.joinable()) post(Command{Command::UPDATE, false, idle_cycles});
+    else for(uint64_t n = idle_cycles; n; --n) dramsim->update();
+    idle_cycles = 0;
+}
+
+void DramSimMemory::add(bool is_write, uint64_t address) {
+    catch_up();
+    ++outstanding;
+    AddressOrder* order = address_order.find(address | is_write);
+    if (!order) order = &address_order.insert(address | is_write, AddressOrder{0, 0});
+    added_cycle.insert(added_key(address | is_write, order->added++), cycle);
+    if (thread.joinable()) post(Command{Command::ADD, is_write, address});
+    else assert(dramsim->addTransaction(is_write, address));
+}
+
+void DramSimMemory::post(const Command& cmd) {
+    unsigned spins = 0;
+    while(!cmds.push(cmd)) cpu_relax(spins);
+    ++cmds_posted;
+}
+
+void DramSimMemory::wait() {
+    unsigned spins = 0;
+    while(cmds_done.load(memory_order_acquire) != cmds_posted) cpu_relax(spins);
+}
+
+void DramSimMemory::thread_main() {
+    Command cmd;
+    unsigned spins = 0;
+    for(uint64_t n_done = 0; ; ) {
+        if (!cmds.pop(cmd)) {
+            cpu_relax(spins);
+            continue;
+        }
+        switch(cmd.op) {
+        case Command::UPDATE:
+            for(uint64_t n = cmd.arg; n; --n) dramsim->update();
+            break;
+        case Command::ADD:
+            assert(dramsim->addTransaction(cmd.is_write, cmd.arg));
+            break;
+        case Command::STOP:
+            return;
+        }
+        cmds_done.store(++n_done, memory_order_release);
+    }
+}
+
+void DramSimMemory::completed(unsigned channel, bool is_write, uint64_t address) {
+    --outstanding;
+    AddressOrder* order = address_order.find(address | is_write);
+    assert(order && channel < channels.size());
+    uint64_t* start = added_cycle.find(added_key(address | is_write, order->completed++));
+    assert(start);
+    ChannelStats& stats = channels[channel];
+    ++(is_write ? stats.writes : stats.reads);
+    stats.latency += cycle - *start;
+    added_cycle.erase(start);
+    if (order->completed == order->added) address_order.erase(order);
+    complete(is_write, address);
+}
+
+void DramSimMemory::read_complete(unsigned id, uint64_t address, uint64_t clock_cycle) {
+    completed(id, false, address);
+}
+void DramSimMemory::write_complete(unsigned id, uint64_t address, uint64_t clock_cycle) {
+    completed(id, true, address);
+}
+
+void DramSimMemory::read_queued(unsigned id, uint64_t address, uint64_t clock_cycle) {
+    assert(done.push(Completion{false, id, address}));
+}
+void DramSimMemory::write_queued(unsigned id, uint64_t address, uint64_t clock_cycle) {
+    assert(done.push(Completion{true, id, address}));
+}
+
+void DramSimMemory::print_stats(ostream& os, uint64_t cycles) {
+    double ns = (double)cycles * ps_per_clock / 1000;
+    for(size_t i = 0; i < channels.size(); ++i) {
+        const ChannelStats& stats = channels[i];
+        uint64_t n = stats.reads + stats.writes;
+        os << std::dec << "== DRAM channel " << i << ": " << stats.reads << " reads, " << stats.writes << " writes, "
+           << fixed << setprecision(1) << (n ? (double)stats.latency/n : 0.0) << " cycles average latency, "
+           << (ns ? 100.0*n*burst_ns/ns : 0.0) << "% data bus utilization" << defaultfloat << endl;
+    }
+}
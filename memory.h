@@ -0,0 +1,131 @@
+#ifndef __MEMORY_H
+#define __MEMORY_H
+
+#include <stdint.h>
+#include <functional>
+#include <vector>
+#include <iosfwd>
+#include <atomic>
+#include <thread>
+#include "DRAMSim2/DRAMSim.h"
+#include "ring_buffer.h"
+
+// Timing model behind the AXI port.  System hands it 64-byte transactions (addresses are
+// offsets into guest RAM) and it reports each one back through the completion callback,
+// in the cycle the data would be available.  MEMORY=dramsim (default), fixed or perfect.
+class MemoryBackend {
+public:
+    typedef std::function<void(bool is_write, uint64_t address)> Complete;
+
+    virtual ~MemoryBackend() {}
+
+    virtual bool will_accept(uint64_t address) = 0;
+    virtual void add(bool is_write, uint64_t address) = 0;
+
+    // one memory clock per core clock: start_update() may run in the background while the
+    // RTL evaluates, finish_update() waits for it and delivers the completions of that cycle
+    virtual void start_update() = 0;
+    virtual void finish_update() = 0;
+    virtual bool runs_ahead() const { return false; } // start the next update at the end of a tick
+
+    virtual void sync() {}    // wait for any background work, e.g. before a checkpoint
+    virtual void restart() {} // forget deferred work after a checkpoint is restored
+
+    // per-channel traffic and utilization over the given number of core cycles
+    virtual void print_stats(std::ostream& os, uint64_t cycles) {}
+
+    static MemoryBackend* create(const Complete& complete, uint64_t ramsize, int ps_per_clock);
+};
+
+// Every transaction completes in the cycle after it was added.
+class PerfectMemory : public MemoryBackend {
+    Complete complete;
+    struct Transaction { bool is_write; uint64_t address; };
+    RingBuffer<Transaction, 1024> added;
+
+public:
+    PerfectMemory(const Complete& complete) : complete(complete) {}
+
+    bool will_accept(uint64_t address) { return !added.full(); }
+    void add(bool is_write, uint64_t address) { added.push_back(Transaction{is_write, address}); }
+    void start_update() {}
+    void finish_update();
+};
+
+// Constant latency, and one 64-byte transaction per 64/bandwidth of channel time.
+// MEMORY_LATENCY is in ns (default 50), MEMORY_BANDWIDTH in GB/s (default 6.4).
+class FixedMemory : public MemoryBackend {
+    Complete complete;
+    struct Transaction { bool is_write; uint64_t address, done_ps; };
+    RingBuffer<Transaction, 1024> pending; // in completion order, since latency is constant
+    uint64_t now_ps, channel_free_ps, latency_ps, burst_ps;
+    int ps_per_clock;
+    uint64_t transactions;
+
+public:
+    FixedMemory(const Complete& complete, int ps_per_clock, double latency_ns, double bandwidth_gbps);
+
+    bool will_accept(uint64_t address) { return !pending.full(); }
+    void add(bool is_write, uint64_t address);
+    void start_update() {}
+    void finish_update();
+    void restart();
+    void print_stats(std::ostream& os, uint64_t cycles);
+};
+
+// DRAMSim2, optionally on its own thread (DRAMSIM_THREAD=y) one update ahead of the RTL.
+// Commands and completions cross over through SPSC queues; completions are delivered on
+// the simulation thread in the same order as the inline path.
+// DRAMSIM_DEVICE and DRAMSIM_SYSTEM pick the ini files in dramsim2/ (system-4ch.ini has four
+// independent channels); each channel accepts transactions until its queue is full.
+class DramSimMemory : public MemoryBackend {
+    Complete complete;
+    DRAMSim::MultiChannelMemorySystem* dramsim;
+    uint64_t outstanding;
+    uint64_t idle_cycles; // updates deferred while nothing was outstanding
+
+    uint64_t cycle;
+    int ps_per_clock;
+    // cycle each outstanding transaction was added, keyed by address, direction and a sequence
+    // number, since reads (or writes) to the same address complete in the order they were added
+    struct AddressOrder { uint64_t added, completed; };
+    FlatMap<AddressOrder, 1024> address_order;
+    FlatMap<uint64_t, 1024> added_cycle;
+    static uint64_t added_key(uint64_t address, uint64_t seq) { return address | (seq & 0xffffff) << 40; }
+    struct ChannelStats { uint64_t reads, writes, latency; };
+    std::vector<ChannelStats> channels; // DRAMSim passes the channel number as the callback id
+    double burst_ns;                    // data bus time of one transaction
+    void completed(unsigned channel, bool is_write, uint64_t address);
+
+    struct Command { enum { UPDATE, ADD, STOP } op; bool is_write; uint64_t arg; };
+    struct Completion { bool is_write; unsigned channel; uint64_t address; };
+    std::thread thread;
+    SpscQueue<Command, 1024> cmds;
+    SpscQueue<Completion, 1024> done;
+    uint64_t cmds_posted;
+    std::atomic<uint64_t> cmds_done;
+    void thread_main();
+    void post(const Command& cmd);
+    void wait();
+    void catch_up();
+
+    void read_complete(unsigned id, uint64_t address, uint64_t clock_cycle);
+    void write_complete(unsigned id, uint64_t address, uint64_t clock_cycle);
+    void read_queued(unsigned id, uint64_t address, uint64_t clock_cycle);
+    void write_queued(unsigned id, uint64_t address, uint64_t clock_cycle);
+
+public:
+    DramSimMemory(const Complete& complete, uint64_t ramsize, int ps_per_clock, const char* device_ini, const char* system_ini, const char* results, bool threaded);
+    ~DramSimMemory();
+
+    bool will_accept(uint64_t address);
+    void add(bool is_write, uint64_t address);
+    void start_update();
+    void finish_update();
+    bool runs_ahead() const { return thread.joinable(); }
+    void sync() { wait(); }
+    void restart() { idle_cycles = 0; }
+    void print_stats(std::ostream& os, uint64_t cycles);
+};
+
+#endif
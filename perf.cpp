@@ -0,0 +1,77 @@
+#include <string.h>
+#include <iostream>
+#include <fstream>
+#include <iomanip>
+#include "perf.h"
+
+using namespace std;
+
+vector<PerfCounter> perf_counters;
+
+static uint64_t counter(const char* name) {
+    for(auto& c : perf_counters)
+        if (c.name == name) return c.value;
+    return 0;
+}
+
+static uint64_t instret() {
+    return counter("instret");
+}
+
+static bool is_cpi(const PerfCounter& c) {
+    return !strncmp(c.name.c_str(), "cpi_", 4);
+}
+
+void perf_write_json(const char* filename, uint64_t simulated_cycles, uint64_t skipped_cycles) {
+    ofstream os(filename);
+    if (!os) {
+        cerr << "Cannot write PERF_JSON file " << filename << endl;
+        return;
+    }
+    // counter names are plain identifiers, so they need no escaping
+    os << "{\n  \"counters\": {";
+    for(size_t i = 0; i < perf_counters.size(); ++i)
+        os << (i ? ",\n" : "\n") << "    \"" << perf_counters[i].name << "\": " << perf_counters[i].value;
+    os << "\n  },\n  \"cpi_stack\": {";
+    uint64_t insts = instret();
+    bool first = true;
+    for(auto& c : perf_counters) {
+        if (!is_cpi(c)) continue;
+        os << (first ? "\n" : ",\n") << "    \"" << c.name.substr(4) << "\": " << (insts ? (double)c.value/insts : 0.0);
+        first = false;
+    }
+    os << "\n  },\n  \"harness\": {\n"
+       << "    \"simulated_cycles\": " << simulated_cycles << ",\n"
+       << "    \"skipped_cycles\": " << skipped_cycles << "\n"
+       << "  }\n}\n";
+}
+
+void perf_print_cpi_stack(ostream& os) {
+    uint64_t insts = instret(), cycles = 0;
+    for(auto& c : perf_counters)
+        if (is_cpi(c)) cycles += c.value;
+    if (!insts) return;
+    os << std::dec << fixed << setprecision(3) << "== CPI stack: " << (double)cycles/insts << " cycles per instruction" << endl;
+    for(auto& c : perf_counters) {
+        if (!is_cpi(c)) continue;
+        os << "==   " << left << setw(18) << c.name.substr(4) << right << setw(8) << (double)c.value/insts
+           << setprecision(1) << setw(7) << 100.0*c.value/cycles << "%" << setprecision(3) << endl;
+    }
+    os << defaultfloat;
+}
+
+void perf_print_branch_prediction(ostream& os) {
+    uint64_t branches = counter("branches"), jumps = counter("jumps");
+    uint64_t branch_miss = counter("branch_mispredicts"), jump_miss = counter("jump_mispredicts");
+    os << std::dec << fixed << setprecision(2) << "== Branch prediction: "
+       << branches << " branches " << (branches ? 100.0*(branches - branch_miss)/branches : 0.0) << "% correct, "
+       << jumps << " jumps " << (jumps ? 100.0*(jumps - jump_miss)/jumps : 0.0) << "% correct" << endl << defaultfloat;
+}
+
+extern "C" {
+
+    void perf_counter(const char* name, long long value) {
+        perf_counters.push_back(PerfCounter{name, (uint64_t)value});
+    }
+
+}
@@ -0,0 +1,27 @@
+#ifndef __PERF_H
+#define __PERF_H
+
+#include <stdint.h>
+#include <string>
+#include <iosfwd>
+#include <vector>
+
+// Hardware performance counters of the core (perf_counters.sv), each reported through the
+// perf_counter DPI call when top.final() runs, in declaration order.
+struct PerfCounter {
+    std::string name;
+    uint64_t value;
+};
+extern std::vector<PerfCounter> perf_counters;
+
+// Writes {"counters": {...}, "cpi_stack": {...}, "harness": {...}} to filename; the harness
+// part holds the simulated and skipped (SKIP_STALLS=y) cycle counts as seen by the harness
+void perf_write_json(const char* filename, uint64_t simulated_cycles, uint64_t skipped_cycles);
+
+// The cpi_* counters as cycles per retired instruction, one line per cause
+void perf_print_cpi_stack(std::ostream& os);
+
+// Direction and target accuracy of conditional branches and of jal/jalr
+void perf_print_branch_prediction(std::ostream& os);
+
+#endif
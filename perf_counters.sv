@@ -0,0 +1,152 @@
+// Hardware performance counters.  Each input is one event per cycle; the totals go to the
+// harness through perf_counter() when the model's final blocks run (top.final()), and
+// PERF_JSON=<file> writes them out.  Counting starts at the last reset, so fast-forwarded
+// instructions are not included.  The cpi_* counters split the cycles into a CPI stack:
+// every cycle counts in exactly one of them, by cpi_cause.
+module PerfCounters (
+    input  logic        clk,
+    input  logic        reset,
+
+    // cycles the harness advanced without evaluating the core since the previous rising edge
+    // (SKIP_STALLS=y); the core was blocked throughout, so they repeat the events of the cycle before
+    input  logic [63:0] skipped,
+
+    input  logic        retired,
+    input  logic        icache_hit,
+    input  logic        icache_miss,
+    input  logic        icache_refilling,
+    input  logic        dcache_hit,
+    input  logic        dcache_miss,
+    input  logic        dcache_refilling,
+    input  logic        load_stall,
+    input  logic        store_stall,
+    input  logic        raw_id_ex,
+    input  logic        raw_ex_mem,
+    input  logic        raw_mem_wb,
+    input  logic        ecall_stall,
+    input  logic        branch_flush,      // a mispredicted branch or jalr resolved in EX
+    input  logic        jump_redirect,     // decode redirected fetch to a jal's target
+    input  logic        branch_resolved,   // a conditional branch resolved
+    input  logic        jump_resolved,     // a jal or jalr resolved
+    input  logic        arbiter_conflict,
+    input  logic        pending_stall,     // decode waits for a load miss's refill
+    input  logic        mshr_busy,         // a load miss is outstanding
+    input  logic        mshr_stall,        // an access in MEM waits for the MSHRs
+    input  logic        hit_under_miss,
+    input  logic        miss_under_miss,
+
+    input  stall_cause_t cpi_cause     // what this cycle is charged to in the CPI stack
+);
+
+    localparam CYCLES           = 0;
+    localparam INSTRET          = 1;
+    localparam ICACHE_HITS      = 2;
+    localparam ICACHE_MISSES    = 3;
+    localparam ICACHE_REFILL    = 4;
+    localparam DCACHE_HITS      = 5;
+    localparam DCACHE_MISSES    = 6;
+    localparam DCACHE_REFILL    = 7;
+    localparam LOAD_STALL       = 8;
+    localparam STORE_STALL      = 9;
+    localparam RAW_ID_EX        = 10;
+    localparam RAW_EX_MEM       = 11;
+    localparam RAW_MEM_WB       = 12;
+    localparam ECALL_STALL      = 13;
+    localparam BRANCH_FLUSHES   = 14;
+    localparam ARBITER_CONFLICT = 15;
+    localparam BRANCHES         = 16;
+    localparam BRANCH_MISPRED   = 17;
+    localparam JUMPS            = 18;
+    localparam JUMP_MISPRED     = 19;
+    localparam PENDING_STALL    = 20;
+    localparam MSHR_BUSY        = 21;
+    localparam MISS_OVERLAP     = 22;
+    localparam MSHR_STALL       = 23;
+    localparam HIT_UNDER_MISS   = 24;
+    localparam MISS_UNDER_MISS  = 25;
+    localparam CPI_STACK        = 26; // one per stall_cause_t, CAUSE_BASE first
+    localparam NUM_CAUSES       = 9;
+    localparam NUM_COUNTERS     = CPI_STACK + NUM_CAUSES;
+
+    logic [NUM_COUNTERS-1:0] events, last_events;
+    logic [63:0]             count [0:NUM_COUNTERS-1];
+
+    assign events[CYCLES]           = 1'b1;
+    assign events[INSTRET]          = retired;
+    assign events[ICACHE_HITS]      = icache_hit;
+    assign events[ICACHE_MISSES]    = icache_miss;
+    assign events[ICACHE_REFILL]    = icache_refilling;
+    assign events[DCACHE_HITS]      = dcache_hit;
+    assign events[DCACHE_MISSES]    = dcache_miss;
+    assign events[DCACHE_REFILL]    = dcache_refilling;
+    assign events[LOAD_STALL]       = load_stall;
+    assign events[STORE_STALL]      = store_stall;
+    assign events[RAW_ID_EX]        = raw_id_ex;
+    assign events[RAW_EX_MEM]       = raw_ex_mem;
+    assign events[RAW_MEM_WB]       = raw_mem_wb;
+    assign events[ECALL_STALL]      = ecall_stall;
+    assign events[BRANCH_FLUSHES]   = branch_flush || jump_redirect;
+    assign events[ARBITER_CONFLICT] = arbiter_conflict;
+    assign events[BRANCHES]         = branch_resolved;
+    assign events[BRANCH_MISPRED]   = branch_resolved && branch_flush;
+    assign events[JUMPS]            = jump_resolved;
+    assign events[JUMP_MISPRED]     = (jump_resolved && branch_flush) || jump_redirect;
+    assign events[PENDING_STALL]    = pending_stall;
+    assign events[MSHR_BUSY]        = mshr_busy;
+    assign events[MISS_OVERLAP]     = mshr_busy && retired; // miss latency hidden behind execution
+    assign events[MSHR_STALL]       = mshr_stall;
+    assign events[HIT_UNDER_MISS]   = hit_under_miss;
+    assign events[MISS_UNDER_MISS]  = miss_under_miss;
+    assign events[CPI_STACK +: NUM_CAUSES] = NUM_CAUSES'(1) << cpi_cause;
+
+    always_ff @(posedge clk or posedge reset) begin
+        if (reset) begin
+            last_events <= '0;
+            for (int i = 0; i < NUM_COUNTERS; i++) count[i] <= '0;
+        end else begin
+            last_events <= events;
+            for (int i = 0; i < NUM_COUNTERS; i++) begin
+                count[i] <= count[i] + {63'd0, events[i]} + (last_events[i] ? skipped : 64'd0);
+            end
+        end
+    end
+
+    final begin
+        perf_counter("cycles",                      count[CYCLES]);
+        perf_counter("instret",                     count[INSTRET]);
+        perf_counter("icache_hits",                 count[ICACHE_HITS]);
+        perf_counter("icache_misses",               count[ICACHE_MISSES]);
+        perf_counter("icache_refill_cycles",        count[ICACHE_REFILL]);
+        perf_counter("dcache_hits",                 count[DCACHE_HITS]);
+        perf_counter("dcache_misses",               count[DCACHE_MISSES]);
+        perf_counter("dcache_refill_cycles",        count[DCACHE_REFILL]);
+        perf_counter("load_miss_stall_cycles",      count[LOAD_STALL]);
+        perf_counter("store_miss_stall_cycles",     count[STORE_STALL]);
+        perf_counter("raw_id_ex_stall_cycles",      count[RAW_ID_EX]);
+        perf_counter("raw_ex_mem_stall_cycles",     count[RAW_EX_MEM]);
+        perf_counter("raw_mem_wb_stall_cycles",     count[RAW_MEM_WB]);
+        perf_counter("ecall_stall_cycles",          count[ECALL_STALL]);
+        perf_counter("branch_flushes",              count[BRANCH_FLUSHES]);
+        perf_counter("arbiter_conflict_cycles",     count[ARBITER_CONFLICT]);
+        perf_counter("branches",                    count[BRANCHES]);
+        perf_counter("branch_mispredicts",          count[BRANCH_MISPRED]);
+        perf_counter("jumps",                       count[JUMPS]);
+        perf_counter("jump_mispredicts",            count[JUMP_MISPRED]);
+        perf_counter("load_pending_stall_cycles",   count[PENDING_STALL]);
+        perf_counter("dcache_mshr_busy_cycles",     count[MSHR_BUSY]);
+        perf_counter("dcache_miss_overlap_cycles",  count[MISS_OVERLAP]);
+        perf_counter("dcache_mshr_stall_cycles",    count[MSHR_STALL]);
+        perf_counter("dcache_hit_under_miss",       count[HIT_UNDER_MISS]);
+        perf_counter("dcache_miss_under_miss",      count[MISS_UNDER_MISS]);
+        perf_counter("cpi_base",                    count[CPI_STACK + CAUSE_BASE]);
+        perf_counter("cpi_icache_miss",             count[CPI_STACK + CAUSE_ICACHE]);
+        perf_counter("cpi_dcache_load_miss",        count[CPI_STACK + CAUSE_LOAD]);
+        perf_counter("cpi_dcache_store_miss",       count[CPI_STACK + CAUSE_STORE]);
+        perf_counter("cpi_raw_id_ex",               count[CPI_STACK + CAUSE_RAW_ID_EX]);
+        perf_counter("cpi_raw_ex_mem",              count[CPI_STACK + CAUSE_RAW_EX_MEM]);
+        perf_counter("cpi_raw_mem_wb",              count[CPI_STACK + CAUSE_RAW_MEM_WB]);
+        perf_counter("cpi_branch",                  count[CPI_STACK + CAUSE_BRANCH]);
+        perf_counter("cpi_ecall",                   count[CPI_STACK + CAUSE_ECALL]);
+    end
+
+endmodule
@@ -8,9 +8,11 @@ module IF_ID (
     input  logic [31:0] instruction_in,
     input  logic [63:0] pc_in,
     input  logic        icache_valid_in,
+    input  branch_pred_t pred_in,
     output logic [31:0] instruction_out,
     output logic [63:0] pc_out,
     output logic        icache_valid_out,
+    output branch_pred_t pred_out,
     output logic        flush_out
 );
     always_ff @(posedge clk or posedge reset) begin
@@ -19,17 +21,20 @@ module IF_ID (
             instruction_out        <= 32'b0;
             pc_out                 <= 64'b0;
             icache_valid_out       <= 1'b0;
+            pred_out               <= '0;
             flush_out              <= 1'b1;
         end else if (enable) begin
             if (flush_in) begin
                 instruction_out        <= 32'b0; 
                 pc_out                 <= 1'b0;
                 icache_valid_out       <= 1'b0;
+                pred_out               <= '0;
                 flush_out              <= 1'b1;
             end else begin
                 instruction_out        <= instruction_in;
                 pc_out                 <= pc_in;
                 icache_valid_out       <= icache_valid_in;
+                pred_out               <= pred_in;
                 flush_out              <= 1'b0;
             end
         end
@@ -44,6 +49,8 @@ module ID_EX (
     input  packed_inst decoded_inst_in,
     input  logic [63:0]  rs1_data_in,
     input  logic [63:0]  rs2_data_in,
+    input  logic [63:0]  rs1_hold_in,   // operands after the EX bypass, kept while the stage holds
+    input  logic [63:0]  rs2_hold_in,
     output packed_inst decoded_inst_out,
     output logic [63:0]  rs1_data_out,
     output logic [63:0]  rs2_data_out,
@@ -67,6 +74,10 @@ module ID_EX (
                 rs2_data_out     <= rs2_data_in;
                 flush_out        <= 1'b0;
             end
+        end else begin
+            // the producer may leave MEM/WB while this instruction waits
+            rs1_data_out     <= rs1_hold_in;
+            rs2_data_out     <= rs2_hold_in;
         end
     end
 endmodule
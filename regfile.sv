@@ -9,6 +9,10 @@ module Regfile (
     input logic [4:0]  rd,
     input logic [63:0] rd_data,
     input logic        write_enable,
+    // a refill completing a load that missed (dcache.sv)
+    input logic [4:0]  fill_rd,
+    input logic [63:0] fill_data,
+    input logic        fill_enable,
     input logic [63:0] wb_pc,
     output [63:0] a0,
     output [63:0] a1,
@@ -24,16 +28,24 @@ module Regfile (
     always_ff @(posedge clk or posedge reset) begin
         if (reset) begin
             for (int i = 0; i < 32; i++) begin
-                registers[i] <= 64'b0;
+                registers[i] <= initial_reg(i, (i == 2) ? initial_sp : 64'b0);
+            end
+        end else begin
+            if (fill_enable && fill_rd != 5'd0) begin
+                registers[fill_rd] <= fill_data;
+            end
+            // written back by a younger instruction
+            if (write_enable && rd != 5'd0) begin
+                registers[rd] <= rd_data;
             end
-            registers[2] <= initial_sp;
-        end else if (write_enable && rd != 5'd0) begin
-            registers[rd] <= rd_data;
         end
     end
 
-    assign rd1_data = registers[rs1];
-    assign rd2_data = registers[rs2];
+    // write-before-read: the values being written back this cycle are visible to the read in ID
+    assign rd1_data = (write_enable && rd != 5'd0 && rd == rs1) ? rd_data :
+                      (fill_enable && fill_rd != 5'd0 && fill_rd == rs1) ? fill_data : registers[rs1];
+    assign rd2_data = (write_enable && rd != 5'd0 && rd == rs2) ? rd_data :
+                      (fill_enable && fill_rd != 5'd0 && fill_rd == rs2) ? fill_data : registers[rs2];
     assign a0 = registers[5'd10];
     assign a1 = registers[5'd11];
     assign a2 = registers[5'd12];
@@ -0,0 +1,155 @@
+#ifndef __RING_BUFFER_H
+#define __RING_BUFFER_H
+
+#include <assert.h>
+#include <stddef.h>
+#include <string.h>
+#include <atomic>
+#include <thread>
+
+// Busy-wait step for the SPSC hand-off: spin briefly, then give the core away
+// so that both threads still make progress on hosts with fewer cores than threads.
+static inline void cpu_relax(unsigned& spins) {
+    if (++spins < 64) {
+#if defined(__x86_64__) || defined(__i386__)
+        __builtin_ia32_pause();
+#endif
+    } else {
+        spins = 0;
+        std::this_thread::yield();
+    }
+}
+
+// Fixed-capacity FIFO used for the AXI R/B/AC beat queues.  N must be a power
+// of two; head and tail run freely and are masked on access.
+template<typename T, size_t N>
+class RingBuffer {
+    static_assert((N & (N-1)) == 0, "RingBuffer size must be a power of two");
+
+    T buf[N];
+    size_t head, tail;
+
+public:
+    RingBuffer() : head(0), tail(0) {}
+
+    bool empty() const { return head == tail; }
+    bool full() const { return tail - head == N; }
+    size_t size() const { return tail - head; }
+    void clear() { head = tail = 0; }
+
+    T& front() { return buf[head & (N-1)]; }
+
+    void push_back(const T& v) {
+        assert(!full()); // if this gets triggered, the queue needs to be bigger
+        buf[tail++ & (N-1)] = v;
+    }
+
+    void pop_front() {
+        assert(!empty());
+        ++head;
+    }
+};
+
+// Lock-free single-producer/single-consumer FIFO for handing work between the
+// simulation thread and the DRAMSim thread.  push() and pop() fail instead of
+// blocking, so the caller decides whether to spin.
+template<typename T, size_t N>
+class SpscQueue {
+    static_assert((N & (N-1)) == 0, "SpscQueue size must be a power of two");
+
+    T buf[N];
+    alignas(64) std::atomic<size_t> head; // written by the consumer
+    alignas(64) std::atomic<size_t> tail; // written by the producer
+
+public:
+    SpscQueue() : head(0), tail(0) {}
+
+    bool push(const T& v) {
+        size_t t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == N) return false;
+        buf[t & (N-1)] = v;
+        tail.store(t+1, std::memory_order_release);
+        return true;
+    }
+
+    bool pop(T& v) {
+        size_t h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire)) return false;
+        v = buf[h & (N-1)];
+        head.store(h+1, std::memory_order_release);
+        return true;
+    }
+};
+
+// Open-addressed (linear probing) hash table keyed by a 64-bit address.
+// Keys are bus addresses, so ~0 is never a valid key and marks empty slots.
+// Erase uses backward-shift deletion, so there are no tombstones to clean up.
+template<typename V, size_t N>
+class FlatMap {
+    static_assert((N & (N-1)) == 0, "FlatMap size must be a power of two");
+    static const unsigned long long EMPTY = ~0ULL;
+
+    unsigned long long keys[N];
+    V vals[N];
+    size_t count;
+
+    static size_t home(unsigned long long key) {
+        key ^= key >> 33;
+        key *= 0xff51afd7ed558ccdULL;
+        key ^= key >> 33;
+        return key & (N-1);
+    }
+
+public:
+    FlatMap() { clear(); }
+
+    bool empty() const { return count == 0; }
+    size_t size() const { return count; }
+    void clear() {
+        memset(keys, 0xff, sizeof(keys));
+        count = 0;
+    }
+
+    V* find(unsigned long long key) {
+        for(size_t i = home(key); ; i = (i+1) & (N-1)) {
+            if (keys[i] == key) return &vals[i];
+            if (keys[i] == EMPTY) return NULL;
+        }
+    }
+
+    V& insert(unsigned long long key, const V& val) {
+        assert(key != EMPTY);
+        size_t i = home(key);
+        while(keys[i] != EMPTY && keys[i] != key) i = (i+1) & (N-1);
+        if (keys[i] == EMPTY) {
+            assert(count < N-1); // always keep one empty slot so find() terminates
+            keys[i] = key;
+            ++count;
+        }
+        vals[i] = val;
+        return vals[i];
+    }
+
+    // calls f(key, value) for every entry; f must not insert or erase
+    template<typename F> void for_each(F f) {
+        for(size_t i = 0; i < N; ++i)
+            if (keys[i] != EMPTY) f(keys[i], vals[i]);
+    }
+
+    void erase(V* v) {
+        size_t i = v - vals;
+        assert(i < N && keys[i] != EMPTY);
+        for(size_t j = (i+1) & (N-1); keys[j] != EMPTY; j = (j+1) & (N-1)) {
+            // move j into the hole at i unless its home slot lies cyclically in (i, j]
+            if (((j - home(keys[j])) & (N-1)) >= ((j - i) & (N-1))) {
+                keys[i] = keys[j];
+                vals[i] = vals[j];
+                i = j;
+            }
+        }
+        keys[i] = EMPTY;
+        --count;
+    }
+};
+
+#endif
@@ -0,0 +1,304 @@
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <array>
+#include <random>
+#include <algorithm>
+#include <math.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "simpoint.h"
+#include "iss.h"
+#include "config.h"
+
+using namespace std;
+
+SimpointSample* simpoint_sample = NULL;
+
+struct SimpointResult {
+    uint64_t insts, cycles;
+};
+
+typedef array<double, SIMPOINT_PROJ_DIMS> Point;
+
+bool SimpointSample::retired(uint64_t instret, uint64_t cycle) {
+    if (!measuring) {
+        if (instret < warmup_end) return false;
+        measuring = true;
+        start_instret = instret;
+        start_cycle = cycle;
+    }
+    return instret >= measure_end;
+}
+
+void SimpointSample::report(uint64_t instret, uint64_t cycle) {
+    SimpointResult r = { 0, 0 };
+    if (measuring) r = SimpointResult{ instret - start_instret, cycle - start_cycle };
+    assert(write(result_fd, &r, sizeof(r)) == sizeof(r));
+    close(result_fd);
+}
+
+void simpoint_profile(System& sys, Vtop& top, const char* filename, uint64_t interval) {
+    ofstream bb(filename);
+    unordered_map<uint64_t, uint64_t> counts;
+    unordered_map<uint64_t, unsigned> ids; // SimPoint wants small dense block ids, starting at 1
+    Iss iss(&sys, &top, false);
+    iss.bbv = &counts;
+    while(!iss.stopped) {
+        uint64_t start = iss.instret;
+        iss.run(interval);
+        if (iss.instret == start) break;
+        bb << "T";
+        for(auto& c : counts) {
+            auto id = ids.insert(make_pair(c.first, ids.size()+1)).first;
+            bb << ":" << id->second << ":" << c.second << " ";
+        }
+        bb << "\n";
+        counts.clear();
+    }
+    if (!Verilated::gotFinish()) cerr << "== Profile stopped early at pc 0x" << std::hex << iss.pc << std::dec << ", the ISS cannot run that instruction" << endl;
+    cerr << "== Profiled " << iss.instret << " instructions in " << (iss.instret + interval - 1)/interval << " intervals" << endl;
+}
+
+// random projection of a normalized basic-block vector, as in SimPoint
+static Point project(const vector<pair<unsigned, double> >& bbv) {
+    Point p;
+    p.fill(0);
+    for(auto& b : bbv)
+        for(int d = 0; d < SIMPOINT_PROJ_DIMS; ++d) {
+            uint64_t h = (uint64_t)b.first * SIMPOINT_PROJ_DIMS + d + 0x9e3779b97f4a7c15ULL;
+            h = (h ^ (h >> 30)) * 0xbf58476d1ce4e5b9ULL;
+            h = (h ^ (h >> 27)) * 0x94d049bb133111ebULL;
+            h ^= h >> 31;
+            p[d] += b.second * ((double)(h >> 11) / (1ULL << 53) * 2 - 1);
+        }
+    return p;
+}
+
+static double distance(const Point& a, const Point& b) {
+    double d = 0;
+    for(int i = 0; i < SIMPOINT_PROJ_DIMS; ++i) d += (a[i]-b[i])*(a[i]-b[i]);
+    return d;
+}
+
+static vector<Point> read_bbv(const string& filename) {
+    vector<Point> points;
+    ifstream bb(filename);
+    string line;
+    while(getline(bb, line)) {
+        if (line.empty() || line[0] != 'T') continue;
+        vector<pair<unsigned, double> > bbv;
+        double total = 0;
+        istringstream fields(line.substr(1));
+        char colon;
+        unsigned id;
+        double count;
+        while(fields >> colon >> id >> colon >> count) {
+            bbv.push_back(make_pair(id, count));
+            total += count;
+        }
+        for(auto& b : bbv) b.second /= total;
+        points.push_back(project(bbv));
+    }
+    return points;
+}
+
+// k-means++ seeding followed by Lloyd iterations; returns the cluster of each point
+static vector<int> kmeans(const vector<Point>& points, int k, mt19937_64& rng) {
+    vector<Point> centers;
+    vector<double> nearest(points.size(), INFINITY);
+    centers.push_back(points[rng() % points.size()]);
+    while((int)centers.size() < k) {
+        double sum = 0;
+        for(size_t i = 0; i < points.size(); ++i) {
+            nearest[i] = min(nearest[i], distance(points[i], centers.back()));
+            sum += nearest[i];
+        }
+        if (sum == 0) break; // fewer distinct points than clusters
+        double pick = uniform_real_distribution<double>(0, sum)(rng);
+        size_t i = 0;
+        while(i < points.size()-1 && (pick -= nearest[i]) > 0) ++i;
+        centers.push_back(points[i]);
+    }
+
+    vector<int> cluster(points.size(), -1);
+    for(int iter = 0; iter < 100; ++iter) {
+        bool changed = false;
+        for(size_t i = 0; i < points.size(); ++i) {
+            int best = 0;
+            for(size_t c = 1; c < centers.size(); ++c)
+                if (distance(points[i], centers[c]) < distance(points[i], centers[best])) best = c;
+            if (cluster[i] != best) changed = true;
+            cluster[i] = best;
+        }
+        if (!changed) break;
+        vector<int> size(centers.size(), 0);
+        for(auto& c : centers) c.fill(0);
+        for(size_t i = 0; i < points.size(); ++i) {
+            ++size[cluster[i]];
+            for(int d = 0; d < SIMPOINT_PROJ_DIMS; ++d) centers[cluster[i]][d] += points[i][d];
+        }
+        for(size_t c = 0; c < centers.size(); ++c)
+            for(int d = 0; d < SIMPOINT_PROJ_DIMS; ++d) if (size[c]) centers[c][d] /= size[c];
+    }
+    return cluster;
+}
+
+struct Sample {
+    uint64_t interval;
+    int cluster;
+    SimpointResult result;
+};
+
+void simpoint_run(const char* prefix) {
+    uint64_t interval = config_number("SIMPOINT_INTERVAL", SIMPOINT_INTERVAL);
+    uint64_t warmup = config_number("SIMPOINT_WARMUP", SIMPOINT_WARMUP);
+    int k = config_number("SIMPOINT_K", SIMPOINT_K);
+    int per_cluster = config_number("SIMPOINT_SAMPLES", SIMPOINT_SAMPLES);
+    int jobs = config_number("SIMPOINT_JOBS", 1);
+    mt19937_64 rng(config_number("SIMPOINT_SEED", 1));
+
+    // profile on the ISS, in a child so that it gets a fresh System
+    string bbfn = string(prefix) + ".bb";
+    if (access(bbfn.c_str(), R_OK) != 0) {
+        pid_t pid = fork();
+        assert(pid != -1);
+        if (pid == 0) {
+            config_set("BBV", bbfn.c_str());
+            config_set("BBV_INTERVAL", to_string(interval).c_str());
+            return;
+        }
+        int status;
+        waitpid(pid, &status, 0);
+        if (!WIFEXITED(status) || WEXITSTATUS(status)) {
+            cerr << "SimPoint profiling failed" << endl;
+            exit(-1);
+        }
+    }
+
+    vector<Point> points = read_bbv(bbfn);
+    if (points.empty()) {
+        cerr << "No basic-block vectors in " << bbfn << endl;
+        exit(-1);
+    }
+    if (k > (int)points.size()) k = points.size();
+
+    // cluster, then pick the interval closest to each centroid plus random other members
+    vector<int> cluster = kmeans(points, k, rng);
+    vector<vector<uint64_t> > members(k);
+    vector<Point> centroid(k);
+    for(auto& c : centroid) c.fill(0);
+    for(size_t i = 0; i < points.size(); ++i) {
+        members[cluster[i]].push_back(i);
+        for(int d = 0; d < SIMPOINT_PROJ_DIMS; ++d) centroid[cluster[i]][d] += points[i][d];
+    }
+    vector<Sample> samples;
+    ofstream simpoints(string(prefix) + ".simpoints"), weights(string(prefix) + ".weights");
+    for(int c = 0; c < k; ++c) {
+        if (members[c].empty()) continue;
+        for(int d = 0; d < SIMPOINT_PROJ_DIMS; ++d) centroid[c][d] /= members[c].size();
+        vector<uint64_t>& m = members[c];
+        size_t best = 0;
+        for(size_t i = 1; i < m.size(); ++i)
+            if (distance(points[m[i]], centroid[c]) < distance(points[m[best]], centroid[c])) best = i;
+        swap(m[0], m[best]);
+        for(int s = 1; s < per_cluster && s < (int)m.size(); ++s) swap(m[s], m[s + rng() % (m.size() - s)]);
+        for(int s = 0; s < per_cluster && s < (int)m.size(); ++s) samples.push_back(Sample{ m[s], c, { 0, 0 } });
+        simpoints << m[0] << " " << c << "\n";
+        weights << (double)m.size()/points.size() << " " << c << "\n";
+    }
+    simpoints.close();
+    weights.close();
+
+    // detailed runs: fast-forward on the ISS, warm up on the core, then measure one interval
+    map<pid_t, pair<size_t, int> > running;
+    for(size_t next = 0; next < samples.size() || !running.empty(); ) {
+        if (next < samples.size() && (int)running.size() < jobs) {
+            int fds[2];
+            assert(pipe(fds) == 0);
+            pid_t pid = fork();
+            assert(pid != -1);
+            if (pid == 0) {
+                close(fds[0]);
+                if (!config_get("SIMPOINT_VERBOSE")) {
+                    int null = open("/dev/null", O_WRONLY);
+                    dup2(null, 1);
+                    dup2(null, 2);
+                    close(null);
+                }
+                uint64_t start = samples[next].interval * interval;
+                uint64_t w = min(warmup, start);
+                config_set("FASTFORWARD", start > w ? to_string(start - w).c_str() : NULL);
+                config_set("FF_WARM", "y");
+                simpoint_sample = new SimpointSample{ w, w + interval, 0, 0, false, fds[1] };
+                return;
+            }
+            close(fds[1]);
+            running[pid] = make_pair(next++, fds[0]);
+            continue;
+        }
+        int status;
+        pid_t pid = wait(&status);
+        assert(pid != -1);
+        auto r = running.find(pid);
+        if (r == running.end()) continue;
+        Sample& s = samples[r->second.first];
+        if (read(r->second.second, &s.result, sizeof(s.result)) != sizeof(s.result)) s.result = SimpointResult{ 0, 0 };
+        close(r->second.second);
+        running.erase(r);
+    }
+
+    // stratified estimate: clusters are the strata, weighted by their share of the intervals
+    vector<double> sum(k, 0), sumsq(k, 0);
+    vector<int> n(k, 0);
+    uint64_t detailed = 0;
+    for(auto& s : samples) {
+        if (!s.result.insts) continue;
+        double cpi = (double)s.result.cycles / s.result.insts;
+        sum[s.cluster] += cpi;
+        sumsq[s.cluster] += cpi*cpi;
+        ++n[s.cluster];
+        detailed += s.result.insts;
+    }
+    double pooled = 0;
+    int pooled_df = 0;
+    for(int c = 0; c < k; ++c)
+        if (n[c] > 1) {
+            pooled += sumsq[c] - sum[c]*sum[c]/n[c];
+            pooled_df += n[c] - 1;
+        }
+    double cpi = 0, var = 0, covered = 0;
+    cerr << std::dec;
+    for(int c = 0; c < k; ++c) {
+        if (members[c].empty()) continue;
+        double w = (double)members[c].size()/points.size();
+        if (!n[c]) {
+            cerr << "== cluster " << c << " (weight " << w << "): no completed samples, left out" << endl;
+            continue;
+        }
+        double mean = sum[c]/n[c];
+        double s2 = (n[c] > 1) ? (sumsq[c] - sum[c]*sum[c]/n[c])/(n[c]-1) : pooled_df ? pooled/pooled_df : 0;
+        cpi += w*mean;
+        var += w*w*s2/n[c];
+        covered += w;
+        cerr << "== cluster " << c << " (weight " << w << "): CPI " << mean << " over " << n[c] << " sample(s)" << endl;
+    }
+    if (covered == 0) {
+        cerr << "No SimPoint sample completed" << endl;
+        exit(-1);
+    }
+    cpi /= covered;
+    var /= covered*covered;
+    double err = 1.96*sqrt(var);
+    cerr << "== SimPoint: " << points.size() << " intervals of " << interval << " instructions, " << k << " clusters, "
+         << samples.size() << " samples, " << detailed << " instructions measured in detail" << endl;
+    cerr << "== Weighted CPI " << cpi << " +/- " << err << " (95%), IPC " << 1/cpi
+         << " [" << 1/(cpi+err) << ", " << ((cpi > err) ? 1/(cpi-err) : INFINITY) << "]";
+    if (!pooled_df) cerr << " (no cluster has two samples, so the bound is not estimated)";
+    cerr << endl;
+    exit(0);
+}
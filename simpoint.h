@@ -0,0 +1,31 @@
+#ifndef __SIMPOINT_H
+#define __SIMPOINT_H
+
+#include "system.h"
+
+#define SIMPOINT_INTERVAL   (1000000)   // default instructions per interval
+#define SIMPOINT_WARMUP     (100000)    // default detailed instructions before each measured interval
+#define SIMPOINT_K          (10)        // default number of clusters
+#define SIMPOINT_SAMPLES    (2)         // default detailed samples per cluster, the representative included
+#define SIMPOINT_PROJ_DIMS  (15)        // dimensions the basic-block vectors are projected to
+
+// The measured window of one detailed sample, run in a child process by simpoint_run()
+struct SimpointSample {
+    uint64_t warmup_end, measure_end; // bounds of the measured window in core-retired instructions
+    uint64_t start_instret, start_cycle;
+    bool measuring;
+    int result_fd;
+
+    bool retired(uint64_t instret, uint64_t cycle); // true once the window has been simulated
+    void report(uint64_t instret, uint64_t cycle);
+};
+extern SimpointSample* simpoint_sample; // NULL unless this process simulates a sample
+
+// Profiles (unless <prefix>.bb exists), clusters and runs the samples of binaryfn, then exits
+// with a weighted CPI estimate.  Only returns in the forked children, which continue in main().
+void simpoint_run(const char* prefix);
+
+// Runs the whole guest on the ISS and writes its basic-block vectors in SimPoint's .bb format
+void simpoint_profile(System& sys, Vtop& top, const char* filename, uint64_t interval);
+
+#endif
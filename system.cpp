@@ -9,11 +9,13 @@
 #include <assert.h>
 #include <stdlib.h>
 #include <iostream>
+#include <chrono>
+#include <algorithm>
 #include <arpa/inet.h>
 #include <ncurses.h>
-#include <set>
 #include "system.h"
 #include "hardware.h"
+#include "config.h"
 #include "Vtop.h"
 
 #define STACK_PAGES     (100)
@@ -23,25 +25,42 @@ using namespace std;
 System* System::sys;
 
 System::System(Vtop* top, uint64_t ramsize, const char* binaryfn, const int argc, char* argv[], int ps_per_clock)
-    : top(top), ps_per_clock(ps_per_clock), ramsize(ramsize), max_elf_addr(0), dram_offset(0), show_console(false), interrupts(0), w_count(0), ticks(0), ecall_brk(0), errno_addr(0ULL)
+    : top(top), ps_per_clock(ps_per_clock), ramsize(ramsize), max_elf_addr(0), dram_offset(0), show_console(false), interrupts(0), w_count(0), ticks(0), ecall_brk(0), errno_addr(0ULL), reads_outstanding(0), writes_outstanding(0), memory_update_started(false), skip_ended(false), exit_code(0), tlb_hits(0), tlb_misses(0), fast_forwarding(false), skipped_cycles(0), checkpoint_requested(false)
 {
     sys = this;
 
-    char* HAVETLB = getenv("HAVETLB");
-    use_virtual_memory = HAVETLB && (toupper(*HAVETLB) == 'Y');
+    use_virtual_memory = config_flag("HAVETLB");
 
-    char* FULLSYSTEM = getenv("FULLSYSTEM");
-    full_system = FULLSYSTEM && (toupper(*FULLSYSTEM) == 'Y');
+    full_system = config_flag("FULLSYSTEM");
 
     assert(!full_system || !use_virtual_memory);
 
-    string ram_fn = string("/vtop-system-")+to_string(getpid());
-    ram_fd = shm_open(ram_fn.c_str(), O_RDWR|O_CREAT|O_EXCL, 0600);
-    assert(ram_fd != -1);
-    assert(shm_unlink(ram_fn.c_str()) == 0);
+    // HUGEPAGES=thp asks for transparent huge pages on the shared-memory ram,
+    // HUGEPAGES=hugetlb backs it with explicit huge pages (see /proc/sys/vm/nr_hugepages).
+    // Either way pages are only zero-filled when first touched.
+    const char* HUGEPAGES = config_get("HUGEPAGES");
+    bool hugetlb = HUGEPAGES && !strcmp(HUGEPAGES, "hugetlb");
+    if (hugetlb) {
+        if (use_virtual_memory) {
+            cerr << "HUGEPAGES=hugetlb cannot be used with HAVETLB, guest pages are mapped 4 KB at a time" << endl;
+            exit(-1);
+        }
+        ram_fd = memfd_create("vtop-system", MFD_CLOEXEC|MFD_HUGETLB);
+        if (ram_fd == -1) {
+            cerr << "Could not create a hugetlb memfd for guest ram" << endl;
+            exit(-1);
+        }
+    } else {
+        string ram_fn = string("/vtop-system-")+to_string(getpid());
+        ram_fd = shm_open(ram_fn.c_str(), O_RDWR|O_CREAT|O_EXCL, 0600);
+        assert(ram_fd != -1);
+        assert(shm_unlink(ram_fn.c_str()) == 0);
+    }
     assert(ftruncate(ram_fd, ramsize) == 0);
-    ram = (char*)mmap(NULL, ramsize, PROT_READ|PROT_WRITE, MAP_SHARED, ram_fd, 0);
+    ram = (char*)mmap(NULL, ramsize, PROT_READ|PROT_WRITE, MAP_SHARED|(hugetlb ? MAP_NORESERVE : 0), ram_fd, 0);
     assert(ram != MAP_FAILED);
+    if (HUGEPAGES && !strcmp(HUGEPAGES, "thp") && madvise(ram, ramsize, MADV_HUGEPAGE) != 0)
+        cerr << "madvise(MADV_HUGEPAGE) failed, guest ram stays on 4 KB pages" << endl;
     if (use_virtual_memory) {
       ram_virt = (char*)mmap(NULL, ramsize, PROT_NONE, MAP_ANONYMOUS|MAP_PRIVATE, -1, 0);
       assert(ram_virt != MAP_FAILED);
@@ -50,6 +69,17 @@ System::System(Vtop* top, uint64_t ramsize, const char* binaryfn, const int argc
       if (full_system) dram_offset = DRAM_OFFSET;
     }
 
+    tlb_flush();
+
+    const char* PAGE_ALLOC = config_get("PAGE_ALLOC");
+    page_alloc_random = !PAGE_ALLOC || strcmp(PAGE_ALLOC, "sequential");
+    const char* PAGE_SEED = config_get("PAGE_SEED");
+    page_rng = PAGE_SEED ? strtoull(PAGE_SEED, NULL, 0) : 1;
+    if (!page_rng) page_rng = 1;
+    free_pages.resize(ramsize/PAGE_SIZE);
+    for(size_t i = 0; i < free_pages.size(); ++i) free_pages[i] = free_pages.size()-1-i; // lowest page at the end
+    free_count = free_pages.size();
+
     if (!full_system) {
       top->satp = get_phys_page() << 12;
       top->stackptr = ramsize - 4*MEGA;
@@ -76,15 +106,13 @@ System::System(Vtop* top, uint64_t ramsize, const char* binaryfn, const int argc
     if (binaryfn) top->entry = load_binary(binaryfn);
     ecall_brk = max_elf_addr;
 
-    // create the dram simulator
-    dramsim = DRAMSim::getMemorySystemInstance("DDR2_micron_16M_8b_x8_sg3E.ini", "system.ini", "../dramsim2", "dram_result", ramsize / MEGA);
-    DRAMSim::TransactionCompleteCB *read_cb = new DRAMSim::Callback<System, void, unsigned, uint64_t, uint64_t>(this, &System::dram_read_complete);
-    DRAMSim::TransactionCompleteCB *write_cb = new DRAMSim::Callback<System, void, unsigned, uint64_t, uint64_t>(this, &System::dram_write_complete);
-    dramsim->RegisterCallbacks(read_cb, write_cb, NULL);
-    dramsim->setCPUClockSpeed(1000ULL*1000*1000*1000/ps_per_clock);
+    // create the memory timing model, MEMORY selects it
+    memory = MemoryBackend::create([this](bool is_write, uint64_t address) { complete(is_write, address); }, ramsize, ps_per_clock);
 }
 
 System::~System() {
+    delete memory;
+
     assert(munmap(ram, ramsize) == 0);
     assert(!use_virtual_memory || munmap(ram_virt, ramsize) == 0);
     assert(close(ram_fd) == 0);
@@ -112,22 +140,42 @@ void System::tick(int clk) {
         if (top->m_axi_arvalid || top->m_axi_awvalid)
             cerr << "Received a bus request during RESET.  Ignoring..." << endl;
         top->m_axi_awready = top->m_axi_wready = top->m_axi_arready = 1;
-        addr_to_tag.clear();
+        transactions.clear();
+        id_order.clear();
+        line_queue.clear();
+        reads_outstanding = writes_outstanding = 0;
         r_queue.clear();
         resp_queue.clear();
         snoop_queue.clear();
+        snoop_pending.clear();
+        snoop_overflow.clear();
         return;
     }
 
     if (!clk) {
         if (top->m_axi_rvalid && top->m_axi_rready) r_queue.pop_front();
         if (top->m_axi_bvalid && top->m_axi_bready) resp_queue.pop_front();
-        if (top->m_axi_acvalid && top->m_axi_acready) snoop_queue.erase(snoop_queue.begin());
+        if (top->m_axi_acvalid && top->m_axi_acready) {
+            snoop_pending.erase(snoop_pending.find(snoop_queue.front()));
+            snoop_queue.pop_front();
+            if (!snoop_overflow.empty()) {
+                uint64_t line = *snoop_overflow.begin();
+                snoop_overflow.erase(snoop_overflow.begin());
+                snoop_pending.insert(line, 0);
+                snoop_queue.push_back(line);
+            }
+        }
         return;
     }
-    rtc_tick(top);
+    if (skip_ended) skip_ended = false;
+    else {
+        rtc_tick(top);
+        memory_update();
+    }
 
-    dramsim->update();    
+    // a request is taken in the cycle it is presented unless its channel is full, and the
+    // core sees the ready at its next edge, so both handshake in the same cycle
+    top->m_axi_arready = top->m_axi_awready = 1;
 
     const Device* device;
     if (top->m_axi_arvalid) {
@@ -147,14 +195,10 @@ void System::tick(int clk) {
             } else if (top->m_axi_arlen+1 != 8) {
                 cerr << "Read request with length != 8 (" << std::dec << top->m_axi_arlen << "+1)" << endl;
                 Verilated::gotFinish(true);
-            } else if (addr_to_tag.find(r_addr)!=addr_to_tag.end()) {
-                cerr << "Access for " << std::hex << r_addr << " already outstanding.  Ignoring read..." << endl;
+            } else if (!accepts(false, r_addr)) {
+                top->m_axi_arready = 0; // the core holds the request until the channel has room
             } else {
-                assert(willAcceptTransaction(r_addr)); // if this gets triggered, need to rethink AXI "ready" signal strategy
-                assert(
-                        dramsim->addTransaction(false, r_addr - dram_offset)
-                      );
-                addr_to_tag[r_addr] = make_pair(top->m_axi_araddr, top->m_axi_arid);
+                issue(false, r_addr - dram_offset, top->m_axi_araddr, top->m_axi_arid);
             }
         }
     }
@@ -162,9 +206,9 @@ void System::tick(int clk) {
     top->m_axi_rvalid = 0;
     if (!r_queue.empty()) {
         top->m_axi_rvalid = 1;
-        top->m_axi_rdata = r_queue.begin()->first;
-        top->m_axi_rid = r_queue.begin()->second.first;
-        top->m_axi_rlast = r_queue.begin()->second.second;
+        top->m_axi_rdata = r_queue.front().data;
+        top->m_axi_rid = r_queue.front().tag;
+        top->m_axi_rlast = r_queue.front().last;
     }
 
     if (top->m_axi_awvalid) {
@@ -185,14 +229,11 @@ void System::tick(int clk) {
             } else if (top->m_axi_awlen+1 != 8) {
                 cerr << "Write request with length != 8 (" << std::dec << top->m_axi_awlen << "+1)" << endl;
                 Verilated::gotFinish(true);
-            } else if (addr_to_tag.find(w_addr)!=addr_to_tag.end()) {
-                cerr << "Access for " << std::hex << w_addr << " already outstanding.  Ignoring write..." << endl;
+            } else if (!accepts(true, w_addr)) {
+                top->m_axi_awready = 0;
+                w_count = 0;
             } else {
-                assert(willAcceptTransaction(w_addr)); // if this gets triggered, need to rethink AXI "ready" signal strategy
-                assert(
-                        dramsim->addTransaction(true, w_addr - dram_offset)
-                      );
-                addr_to_tag[w_addr] = make_pair(top->m_axi_awaddr, top->m_axi_awid);
+                issue(true, w_addr - dram_offset, top->m_axi_awaddr, top->m_axi_awid);
             }
         }
     }
@@ -201,8 +242,6 @@ void System::tick(int clk) {
         if (full_system && (device = full_system_hardware_match(w_addr))) {
             device->write_data(device, top);
         } else {
-            // if transfer is in progress, can't change mind about willAcceptTransaction()
-            assert(willAcceptTransaction(w_addr));
             *((uint64_t*)(&ram[w_addr - dram_offset + (8-w_count)*8])) = top->m_axi_wdata;
         }
         if(--w_count == 0) assert(top->m_axi_wlast);
@@ -211,36 +250,118 @@ void System::tick(int clk) {
     top->m_axi_bvalid = 0;
     if (!resp_queue.empty()) {
         top->m_axi_bvalid = 1;
-        top->m_axi_bid = *resp_queue.begin();
+        top->m_axi_bid = resp_queue.front();
     }
 
     top->m_axi_acvalid = 0;
     if (!snoop_queue.empty()) {
         top->m_axi_acvalid = 1;
-        top->m_axi_acaddr = *snoop_queue.begin();
+        top->m_axi_acaddr = snoop_queue.front();
         top->m_axi_acsnoop = 0xD; // MakeInvalid
     }
+
+    // let a background memory model run the next cycle's update while the RTL evaluates
+    if (memory->runs_ahead()) {
+        memory->start_update();
+        memory_update_started = true;
+    }
+}
+
+// A blocked core only changes state when a response arrives, and the harness only
+// changes the core's inputs when it has something queued for it or a request to take.
+bool System::can_skip() {
+    return top->mem_blocked && !full_system && !top->reset
+        && r_queue.empty() && resp_queue.empty() && snoop_queue.empty() && !w_count
+        && !top->m_axi_arvalid && !top->m_axi_awvalid && !top->m_axi_wvalid;
+}
+
+// Runs one cycle of everything but the core, after the rising edge of the last evaluated
+// cycle.  Returns false once memory completes a transaction; the caller then evaluates that
+// cycle normally, and tick() leaves out the RTC and memory updates that already happened.
+bool System::skip_cycle() {
+    rtc_tick(top);
+    memory_update();
+    if (!r_queue.empty() || !resp_queue.empty()) {
+        skip_ended = true;
+        return false;
+    }
+    if (memory->runs_ahead()) {
+        memory->start_update();
+        memory_update_started = true;
+    }
+    ticks += ps_per_clock;
+    ++skipped_cycles;
+    return true;
+}
+
+void System::print_memory_stats(std::ostream& os) {
+    memory->print_stats(os, ticks/ps_per_clock);
+}
+
+bool System::accepts(bool is_write, uint64_t addr) {
+    if (transactions.size() >= MAX_OUTSTANDING) return false;
+    // every response must fit in its queue, even if all complete before the core takes any
+    if (is_write ? resp_queue.size() + writes_outstanding >= RESP_QUEUE_SIZE
+                 : r_queue.size() + 8*(reads_outstanding+1) > R_QUEUE_SIZE) return false;
+    return memory->will_accept(addr - dram_offset);
+}
+
+void System::memory_update() {
+    if (!memory_update_started) memory->start_update();
+    memory_update_started = false;
+    memory->finish_update();
 }
 
 void System::read_response(uint64_t addr, uint64_t value, int tag, bool last) {
-    r_queue.push_back(make_pair(value, make_pair(tag, last)));
+    r_queue.push_back(RBeat{value, tag, last});
 }
 
-void System::dram_read_complete(unsigned id, uint64_t address, uint64_t clock_cycle) {
-    map<uint64_t, pair<uint64_t, int> >::iterator tag = addr_to_tag.find(address + dram_offset);
-    assert(tag != addr_to_tag.end());
-    uint64_t orig_addr = tag->second.first;
-    for(int i = 0; i < 64; i += 8)
-        read_response(address, *((uint64_t*)(&ram[((orig_addr&(~63))+((orig_addr+i)&63)) - dram_offset])), tag->second.second, i+8>=64);
-    addr_to_tag.erase(tag);
+void System::issue(bool is_write, uint64_t line, uint64_t orig_addr, int tag) {
+    IdOrder* order = id_order.find(id_key(is_write, tag));
+    if (!order) order = &id_order.insert(id_key(is_write, tag), IdOrder{0, 0});
+    uint64_t key = transaction_key(is_write, tag, order->issued++);
+    transactions.insert(key, Transaction{orig_addr, ~0ULL, tag, false});
+    LineQueue* same_line = line_queue.find(line | is_write);
+    if (same_line) {
+        transactions.find(same_line->tail)->next_same_line = key;
+        same_line->tail = key;
+    } else line_queue.insert(line | is_write, LineQueue{key, key});
+    ++(is_write ? writes_outstanding : reads_outstanding);
+    memory->add(is_write, line);
 }
 
-void System::dram_write_complete(unsigned id, uint64_t address, uint64_t clock_cycle) {
-    do_finish_write(address, 64);
-    map<uint64_t, pair<uint64_t, int> >::iterator tag = addr_to_tag.find(address + dram_offset);
-    assert(tag != addr_to_tag.end());
-    resp_queue.push_back(tag->second.second);
-    addr_to_tag.erase(tag);
+void System::complete(bool is_write, uint64_t line) {
+    if (is_write) do_finish_write(line, 64);
+    LineQueue* same_line = line_queue.find(line | is_write);
+    assert(same_line);
+    Transaction* t = transactions.find(same_line->head);
+    assert(t && !t->done);
+    t->done = true;
+    if (t->next_same_line == ~0ULL) line_queue.erase(same_line);
+    else same_line->head = t->next_same_line;
+    respond(is_write, t->tag);
+}
+
+// sends the responses of tag's finished transactions, oldest first, up to the first unfinished one
+void System::respond(bool is_write, int tag) {
+    IdOrder* order = id_order.find(id_key(is_write, tag));
+    assert(order);
+    Transaction* t;
+    while(order->returned != order->issued
+          && (t = transactions.find(transaction_key(is_write, tag, order->returned)))->done) {
+        if (is_write) {
+            resp_queue.push_back(tag);
+            --writes_outstanding;
+        } else {
+            uint64_t orig_addr = t->orig_addr;
+            for(int i = 0; i < 64; i += 8)
+                read_response(orig_addr, *((uint64_t*)(&ram[((orig_addr&(~63))+((orig_addr+i)&63)) - dram_offset])), tag, i+8>=64);
+            --reads_outstanding;
+        }
+        transactions.erase(t);
+        ++order->returned;
+    }
+    if (order->returned == order->issued) id_order.erase(order);
 }
 
 void System::set_errno(const int new_errno) {
@@ -251,18 +372,70 @@ void System::set_errno(const int new_errno) {
 }
 
 void System::invalidate(const uint64_t phy_addr) {
-    snoop_queue.insert(phy_addr & ~0x3fULL);
+    if (fast_forwarding) return;
+    uint64_t line = phy_addr & ~0x3fULL;
+    if (snoop_pending.find(line) || snoop_overflow.count(line)) return; // already queued
+    if (snoop_queue.full()) {
+        snoop_overflow.insert(line);
+        return;
+    }
+    snoop_pending.insert(line, 0);
+    snoop_queue.push_back(line);
 }
 
 uint64_t System::get_phys_page() {
-    int page_no;
-    do {
-        page_no = rand()%(ramsize/PAGE_SIZE);
-    } while(phys_page_used[page_no]);
+    if (!free_count) {
+        cerr << "Out of guest physical memory" << endl;
+        exit(-1);
+    }
+    size_t i = free_count-1; // sequential: lowest free page first, then the most recently freed
+    if (page_alloc_random) {
+        page_rng ^= page_rng << 13;
+        page_rng ^= page_rng >> 7;
+        page_rng ^= page_rng << 17;
+        i = page_rng % free_count;
+    }
+    uint64_t page_no = free_pages[i];
+    free_pages[i] = free_pages[--free_count];
     phys_page_used[page_no] = true;
     return page_no;
 }
 
+void System::free_phys_page(uint64_t page_no) {
+    assert(phys_page_used[page_no]);
+    phys_page_used[page_no] = false;
+    free_pages[free_count++] = page_no;
+    // the next owner expects zeroes, and the host gets the memory back: nothing of the old owner may
+    // survive in the caches or in stores still on their way to memory
+    drop_pending_writes(page_no*PAGE_SIZE, PAGE_SIZE);
+    for(uint64_t line = 0; line < PAGE_SIZE; line += 64) invalidate(page_no*PAGE_SIZE + line);
+    assert(fallocate(ram_fd, FALLOC_FL_PUNCH_HOLE|FALLOC_FL_KEEP_SIZE, page_no*PAGE_SIZE, PAGE_SIZE) == 0);
+}
+
+void System::tlb_flush() {
+    for(auto& e : tlb) e.vpn = ~0ULL;
+}
+
+void System::unmap(uint64_t virt_addr, uint64_t len) {
+    if (!use_virtual_memory) return; // memory is identity-mapped, there are no pages to give back
+    for(uint64_t virt = virt_addr & ~(PAGE_SIZE-1); virt < virt_addr + len; virt += PAGE_SIZE) {
+        uint64_t pte_addr = 0, table = top->satp;
+        for(int i = 0; i < 4 && table; i++) {
+            pte_addr = table + ((virt >> (12 + 9*(3-i))) & 0x1ff)*8;
+            uint64_t pte = *(uint64_t*)&ram[pte_addr];
+            table = (pte & VALID_PAGE) ? ((pte&0x0000ffffffffffff)>>10)<<12 : 0;
+        }
+        if (!table) continue; // never touched
+        TlbEntry& e = tlb[(virt >> 12) & (TLB_ENTRIES-1)];
+        if (e.vpn == (virt >> 12)) e.vpn = ~0ULL;
+        *(uint64_t*)&ram[pte_addr] = 0;
+        invalidate(pte_addr);
+        free_phys_page(table >> 12);
+        void* old_virt = ram_virt + virt;
+        assert(mmap(old_virt, PAGE_SIZE, PROT_NONE, MAP_ANONYMOUS|MAP_PRIVATE|MAP_FIXED, -1, 0) == old_virt);
+    }
+}
+
 #define VM_DEBUG 1
 
 uint64_t System::get_pte(uint64_t base_addr, int vpn, bool isleaf, bool& allocated) {
@@ -300,10 +473,17 @@ uint64_t System::virt_to_phy(const uint64_t virt_addr) {
       return virt_addr;
     }
 
-    bool allocated;
-    uint64_t pt_base_addr = top->satp;
     uint64_t phy_offset = virt_addr & (PAGE_SIZE-1);
     uint64_t tmp_virt_addr = virt_addr >> 12;
+    TlbEntry& e = tlb[tmp_virt_addr & (TLB_ENTRIES-1)];
+    if (e.vpn == tmp_virt_addr && e.satp == top->satp) {
+        ++tlb_hits;
+        return e.phys_page | phy_offset;
+    }
+    ++tlb_misses;
+
+    bool allocated;
+    uint64_t pt_base_addr = top->satp;
     for(int i = 0; i < 4; i++) {
         int vpn = (tmp_virt_addr & (0x01ff << 9*(3-i))) >> 9*(3-i);
         uint64_t pte = get_pte(pt_base_addr, vpn, i == 3, allocated);
@@ -314,16 +494,28 @@ uint64_t System::virt_to_phy(const uint64_t virt_addr) {
         assert(mmap(new_virt, PAGE_SIZE, PROT_READ|PROT_WRITE, MAP_SHARED|MAP_FIXED, ram_fd, pt_base_addr) == new_virt);
     }
     assert((pt_base_addr | phy_offset) < ramsize);
+    e = TlbEntry{ top->satp, tmp_virt_addr, pt_base_addr };
     return (pt_base_addr | phy_offset);
 }
 
-void System::load_segment(const int fd, const size_t memsz, const size_t filesz, uint64_t virt_addr) {
+void System::load_segment(const int fd, const size_t memsz, const size_t filesz, uint64_t virt_addr, off_t offset) {
     if (VM_DEBUG) cout << "Read " << std::dec << filesz << " bytes at " << std::hex << virt_addr << endl;
-    for(size_t i = 0; i < memsz; ++i) assert(virt_to_phy(virt_addr + i) || (!use_virtual_memory && !virt_addr)); // prefault, 
-    assert(filesz == read(fd, &ram_virt[virt_addr], filesz));
+    // prefault once per page, then read that page's part of the file straight into ram
+    for(size_t done = 0; done < memsz; ) {
+        uint64_t virt = virt_addr + done;
+        size_t len = min(PAGE_SIZE - (virt & (PAGE_SIZE-1)), memsz - done);
+        uint64_t phys = virt_to_phy(virt);
+        assert(phys || (!use_virtual_memory && !virt));
+        if (done < filesz) {
+            size_t n = min(len, filesz - done);
+            assert(pread(fd, &ram[phys], n, offset + done) == (ssize_t)n);
+        }
+        done += len;
+    }
 }
 
 uint64_t System::load_binary(const char* filename) {
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
 
     // open the elf file
     int fd = open(filename, O_RDONLY);
@@ -371,8 +563,7 @@ uint64_t System::load_binary(const char* filename) {
             if (!(shdr.sh_flags & SHF_EXECINSTR)) continue;
 
             // copy segment content from file to memory
-            assert(-1 != lseek(fd, shdr.sh_offset, SEEK_SET));
-            load_segment(fd, shdr.sh_size, shdr.sh_size, 0);
+            load_segment(fd, shdr.sh_size, shdr.sh_size, 0, shdr.sh_offset);
             break; // just load the first one
         }
     } else {
@@ -396,8 +587,7 @@ uint64_t System::load_binary(const char* filename) {
                     << endl;
 
                 // copy segment content from file to memory
-                assert(-1 != lseek(fd, phdr.p_offset, SEEK_SET));
-                load_segment(fd, phdr.p_memsz, phdr.p_filesz, phdr.p_vaddr);
+                load_segment(fd, phdr.p_memsz, phdr.p_filesz, phdr.p_vaddr, phdr.p_offset);
 
                 if (max_elf_addr < (phdr.p_vaddr + phdr.p_memsz))
                     max_elf_addr = (phdr.p_vaddr + phdr.p_memsz);
@@ -424,6 +614,8 @@ uint64_t System::load_binary(const char* filename) {
         max_elf_addr = ((max_elf_addr + PAGE_SIZE-1) / PAGE_SIZE) * PAGE_SIZE;
     }
     // finalize
+    elf_end(elf);
     close(fd);
+    cout << "Loaded " << filename << " in " << std::dec << chrono::duration<double, milli>(chrono::steady_clock::now() - start).count() << " ms" << endl;
     return elf_header.e_entry /* entry point */;
 }
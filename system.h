@@ -1,14 +1,15 @@
 #ifndef __SYSTEM_H
 #define __SYSTEM_H
 
-#include <map>
-#include <list>
-#include <set>
 #include <queue>
+#include <set>
 #include <utility>
 #include <bitset>
-#include "DRAMSim2/DRAMSim.h"
+#include <vector>
+#include <iosfwd>
+#include "memory.h"
 #include "Vtop.h"
+#include "ring_buffer.h"
 
 #define KILO (1024UL)
 #define MEGA (1024UL*1024)
@@ -20,6 +21,12 @@
 
 #define DRAM_OFFSET 0x80000000ULL
 
+#define R_QUEUE_SIZE        (512)   // read data beats, 8 per outstanding burst
+#define RESP_QUEUE_SIZE     (256)   // write responses
+#define SNOOP_QUEUE_SIZE    (8192)  // pending invalidations, one per cache line; more wait in snoop_overflow
+#define MAX_OUTSTANDING     (256)   // transactions in flight to memory
+#define TLB_ENTRIES         (1024)  // direct-mapped translations cached by virt_to_phy
+
 typedef unsigned long __uint64_t;
 typedef __uint64_t uint64_t;
 typedef unsigned int __uint32_t;
@@ -41,25 +48,56 @@ class System {
 
     uint64_t load_binary(const char* filename);
 
-    std::list<std::pair<uint64_t, std::pair<int, bool> > > r_queue;
-    std::list<int> resp_queue;
-    std::set<uint64_t> snoop_queue;
-    std::map<uint64_t, std::pair<uint64_t, int> > addr_to_tag;
+    struct RBeat { uint64_t data; int tag; bool last; };
+
+    RingBuffer<RBeat, R_QUEUE_SIZE> r_queue;
+    RingBuffer<int, RESP_QUEUE_SIZE> resp_queue;
+    RingBuffer<uint64_t, SNOOP_QUEUE_SIZE> snoop_queue;
+    FlatMap<char, 2*SNOOP_QUEUE_SIZE> snoop_pending; // lines already in snoop_queue
+    std::set<uint64_t> snoop_overflow;               // lines queued while snoop_queue was full, e.g. by a large read()
+
+    // Outstanding transactions, keyed by direction, AXI ID and a per-ID sequence number.
+    // Memory completes them by line, oldest first among those to the same line; responses
+    // go back in issue order per ID, so a finished transaction waits for older ones with its ID.
+    struct Transaction { uint64_t orig_addr, next_same_line; int tag; bool done; };
+    struct IdOrder { uint64_t issued, returned; };
+    struct LineQueue { uint64_t head, tail; }; // transaction keys, linked through next_same_line
+    FlatMap<Transaction, 2*MAX_OUTSTANDING> transactions;
+    FlatMap<IdOrder, 2*MAX_OUTSTANDING> id_order;     // by direction and ID, while any is outstanding
+    FlatMap<LineQueue, 2*MAX_OUTSTANDING> line_queue; // by line offset and direction
+    uint64_t reads_outstanding, writes_outstanding;
+    static uint64_t id_key(bool is_write, int tag) { return (uint64_t)is_write << 32 | (uint32_t)tag; }
+    static uint64_t transaction_key(bool is_write, int tag, uint64_t seq) {
+        return (uint64_t)is_write << 63 | (uint64_t)(uint32_t)tag << 40 | (seq & ((1ULL << 40) - 1));
+    }
+    void issue(bool is_write, uint64_t line, uint64_t orig_addr, int tag);
+    void complete(bool is_write, uint64_t line);
+    void respond(bool is_write, int tag);
+
+    void remap_virt(uint64_t table_addr, int level, uint64_t vpn);
 
-    void dram_read_complete(unsigned id, uint64_t address, uint64_t clock_cycle);
-    void dram_write_complete(unsigned id, uint64_t address, uint64_t clock_cycle);
+    // virt_to_phy translation cache, tagged by satp; vpn is ~0 in empty entries
+    struct TlbEntry {
+        uint64_t satp, vpn, phys_page;
+    } tlb[TLB_ENTRIES];
+    void tlb_flush();
 
     std::bitset<GIGA/PAGE_SIZE> phys_page_used;
+    std::vector<uint32_t> free_pages; // free_pages[0..free_count) are the free page numbers
+    size_t free_count;
+    bool page_alloc_random; // PAGE_ALLOC=random (default) or sequential
+    uint64_t page_rng;      // xorshift state for random placement, seeded by PAGE_SEED
     uint64_t get_phys_page();
+    void free_phys_page(uint64_t page_no);
     uint64_t get_pte(uint64_t base_addr, int vpn, bool isleaf, bool& allocated);
     uint64_t load_elf_parts(int fileDescriptor, size_t size, const uint64_t virt_addr);
-    void load_segment(const int fd, const size_t memsz, const size_t filesz, uint64_t virt_addr);
+    void load_segment(const int fd, const size_t memsz, const size_t filesz, uint64_t virt_addr, off_t offset);
 
-    DRAMSim::MultiChannelMemorySystem* dramsim;
-    bool willAcceptTransaction(uint64_t addr) {
-      // hack: false if /any/ memory channel can't accept transaction
-      return dramsim->willAcceptTransaction();
-    }
+    MemoryBackend* memory;
+    bool memory_update_started; // this cycle's update was already issued at the end of the previous one
+    bool skip_ended;            // skip_cycle() already ran this cycle's RTC and memory updates
+    void memory_update();
+    bool accepts(bool is_write, uint64_t addr); // room for one more transaction to addr
     
 public:
     static System* sys;
@@ -72,11 +110,16 @@ public:
     uint64_t ticks;
     int ps_per_clock;
 
+    int exit_code; // guest's exit status, returned by Vtop
+
     bool use_virtual_memory, full_system;
+    bool fast_forwarding; // the ISS is running, so the core's caches hold nothing to invalidate
 
     void set_errno(const int new_errno);
     void invalidate(const uint64_t phys_addr);
     uint64_t virt_to_phy(const uint64_t virt_addr);
+    void unmap(uint64_t virt_addr, uint64_t len);
+    uint64_t tlb_hits, tlb_misses;
     void read_response(uint64_t addr, uint64_t value, int tag, bool last);
 
     char* ram;
@@ -89,6 +132,23 @@ public:
 
     void console();
     void tick(int clk);
+    void print_memory_stats(std::ostream& os);
+
+    // SKIP_STALLS=y: while the core reports mem_blocked, advance whole cycles without evaluating it
+    bool can_skip();
+    bool skip_cycle();
+    uint64_t skipped_cycles;
+
+    // checkpoint.cpp
+    bool checkpoint_requested; // set by the guest's checkpoint marker ecall
+    bool checkpoint_drained();
+    void save_checkpoint(const char* filename);
+    void restore_checkpoint(const char* filename);
 };
 
+// fake-os.cpp: writes the core has performed but not yet sent to memory
+void save_pending_writes(std::ostream& os);
+void restore_pending_writes(std::istream& is);
+void drop_pending_writes(uint64_t phys_addr, uint64_t len);
+
 #endif
@@ -8,13 +8,20 @@
 `include "alu.sv"
 `include "arbiter.sv"
 `include "control.sv"
+`include "branch_predictor.sv"
+`include "perf_counters.sv"
 
 
 module IFStage #(
     parameter ID_WIDTH    = 13,
     parameter ADDR_WIDTH  = 64,
     parameter DATA_WIDTH  = 64,
-    parameter STRB_WIDTH  = DATA_WIDTH / 8
+    parameter STRB_WIDTH  = DATA_WIDTH / 8,
+    parameter ICACHE_SETS = 512,
+    parameter BP_MODE     = 2,
+    parameter BP_PHT_BITS = 12,
+    parameter BP_BTB_BITS = 9,
+    parameter BP_RAS_BITS = 3
 ) (
     input  logic                   clk,
     input  logic                   reset,
@@ -23,6 +30,16 @@ module IFStage #(
     output logic [63:0]            pc_out,
     output logic [31:0]            instruction_out,
 
+    // branch prediction: where fetch goes after pc_in, and the training and recovery inputs
+    input  logic                   fetch,
+    output logic [63:0]            next_pc_out,
+    output branch_pred_t           pred_out,
+    input  packed_inst             resolve_inst,
+    input  logic                   resolve_taken,
+    input  logic [63:0]            resolve_target,
+    input  logic                   recover,
+    input  packed_inst             recover_inst,
+
 
     output logic [ID_WIDTH-1:0]    m_axi_arid,
     output logic [ADDR_WIDTH-1:0]  m_axi_araddr,
@@ -43,14 +60,17 @@ module IFStage #(
     output logic                   m_axi_rready,
 
     input  logic                   flush,     
-    input  logic                   branch_taken  
+    input  logic                   branch_taken,
+
+    output logic                   icache_miss,
+    output logic                   icache_refilling
 );
 
     ICache #(
         .ADDR_WIDTH(ADDR_WIDTH),
         .DATA_WIDTH(DATA_WIDTH),
         .CACHE_LINE_SIZE(512),
-        .NUMBER_OF_SETS(512),
+        .NUMBER_OF_SETS(ICACHE_SETS),
         .NUMBER_OF_WAYS(2),
         .ID_WIDTH(ID_WIDTH)
     ) icache_inst (
@@ -79,7 +99,31 @@ module IFStage #(
         .m_axi_rready(m_axi_rready),
 
         .flush(flush),
-        .stall('0) // Moved stall logic to stall_pc
+        .stall('0), // Moved stall logic to stall_pc
+
+        .miss_out(icache_miss),
+        .refilling_out(icache_refilling)
+    );
+
+    BranchPredictor #(
+        .MODE(BP_MODE),
+        .PHT_BITS(BP_PHT_BITS),
+        .BTB_BITS(BP_BTB_BITS),
+        .RAS_BITS(BP_RAS_BITS)
+    ) predictor (
+        .clk(clk),
+        .reset(reset),
+        .pc(pc_in),
+        .instruction(instruction_out),
+        .valid(if_valid),
+        .fetch(fetch),
+        .next_pc(next_pc_out),
+        .pred(pred_out),
+        .resolve_inst(resolve_inst),
+        .resolve_taken(resolve_taken),
+        .resolve_target(resolve_target),
+        .recover(recover),
+        .recover_inst(recover_inst)
     );
 
     assign pc_out = pc_in;
@@ -91,15 +135,30 @@ module IDStage (
     input  logic         reset,
     input packed_inst decoded_inst_in,
 
-    output packed_inst decoded_inst_out
+    output packed_inst decoded_inst_out,
+
+    // a jal fetch did not predict: fetch is redirected to its target, which becomes its prediction
+    output logic         jump_out,
+    output logic [63:0]  jump_target_out
 );
 
-    assign decoded_inst_out = decoded_inst_in;
+    always_comb begin
+        jump_target_out  = $signed(decoded_inst_in.addr) + $signed(decoded_inst_in.imm);
+        jump_out         = decoded_inst_in.opcode == 7'b1101111 &&
+                           !(decoded_inst_in.pred.taken && decoded_inst_in.pred.target == jump_target_out);
+        decoded_inst_out = decoded_inst_in;
+        if (jump_out) begin
+            decoded_inst_out.pred.taken  = 1'b1;
+            decoded_inst_out.pred.target = jump_target_out;
+        end
+    end
 endmodule
 
 
 
-module EXStage (
+module EXStage #(
+    parameter FORWARDING = 1
+)(
     input  logic                 clk,
     input  logic                 reset,
 
@@ -107,6 +166,16 @@ module EXStage (
     input  logic [63:0]          rs1_data_in,
     input  logic [63:0]          rs2_data_in,
 
+    // bypass from the older instructions in MEM (ALU results only) and WB
+    input  packed_inst           ex_mem_inst_in,
+    input  logic                 ex_mem_flush_in,
+    input  logic [63:0]          ex_mem_result_in,
+    input  logic                 wb_enable_in,
+    input  logic [4:0]           wb_rd_in,
+    input  logic [63:0]          wb_data_in,
+    output logic [63:0]          rs1_fwd_out,
+    output logic [63:0]          rs2_fwd_out,
+
     output logic [63:0]          alu_result_out,
     output packed_inst           decoded_inst_out,
     output logic [63:0]          store_data_out,
@@ -120,11 +189,27 @@ module EXStage (
     logic [63:0] alu_result;
     logic        branch_taken;
     logic [63:0] branch_target;
+    logic        ex_mem_fwd, wb_fwd;
+
+    // a load in MEM has no data yet; ControlUnit keeps its consumer out of EX until it reaches WB
+    assign ex_mem_fwd = FORWARDING && !ex_mem_flush_in && ex_mem_inst_in.reg_write && !ex_mem_inst_in.mem_read
+                        && ex_mem_inst_in.rd != 5'd0;
+    assign wb_fwd     = FORWARDING && wb_enable_in && wb_rd_in != 5'd0;
+
+    always_comb begin
+        if (ex_mem_fwd && ex_mem_inst_in.rd == decoded_inst_in.rs1) rs1_fwd_out = ex_mem_result_in;
+        else if (wb_fwd && wb_rd_in == decoded_inst_in.rs1)        rs1_fwd_out = wb_data_in;
+        else                                                        rs1_fwd_out = rs1_data_in;
+
+        if (ex_mem_fwd && ex_mem_inst_in.rd == decoded_inst_in.rs2) rs2_fwd_out = ex_mem_result_in;
+        else if (wb_fwd && wb_rd_in == decoded_inst_in.rs2)        rs2_fwd_out = wb_data_in;
+        else                                                        rs2_fwd_out = rs2_data_in;
+    end
 
-    assign operand_b = decoded_inst_in.alu_src_imm ? decoded_inst_in.imm  : rs2_data_in;
+    assign operand_b = decoded_inst_in.alu_src_imm ? decoded_inst_in.imm  : rs2_fwd_out;
 
     ALU alu_inst (
-        .a(rs1_data_in),
+        .a(rs1_fwd_out),
         .b(operand_b),
         .instr(decoded_inst_in),
         .result(alu_result),
@@ -136,7 +221,7 @@ module EXStage (
     assign branch_taken_out  = branch_taken;
     assign branch_target_out = branch_target;
     assign decoded_inst_out  = decoded_inst_in;
-    assign store_data_out    = rs2_data_in;
+    assign store_data_out    = rs2_fwd_out;
 
 endmodule
 
@@ -144,7 +229,9 @@ endmodule
 module MemStage #(
     parameter ADDR_WIDTH = 64,
     parameter DATA_WIDTH = 64,
-    parameter ID_WIDTH   = 13
+    parameter ID_WIDTH   = 13,
+    parameter DCACHE_SETS = 512,
+    parameter NUM_MSHRS   = 2
 )(
     input  logic                 clk,
     input  logic                 reset,
@@ -153,6 +240,16 @@ module MemStage #(
     input  logic [DATA_WIDTH-1:0] store_data_in,    
     input  packed_inst        decoded_inst_in,
     input  logic                 flush_ex_mem,
+    input  logic                 hold,              // the instruction in MEM is being flushed by an ECALL
+
+    // a load that missed leaves MEM without its data, and the refill writes its register
+    input  logic                  wb_enable_in,
+    input  logic [4:0]            wb_rd_in,
+    output logic                  load_pending,
+    output logic                  fill_enable,
+    output logic [4:0]            fill_rd,
+    output logic [DATA_WIDTH-1:0] fill_data,
+    output logic [31:0]           pending_regs,
     
     output logic [DATA_WIDTH-1:0] mem_data_out,     
     output logic [ADDR_WIDTH-1:0] alu_result_out,    
@@ -202,30 +299,45 @@ module MemStage #(
     input  logic [3:0]               m_axi_acsnoop,
 
     output logic                  read_done,
-    output logic                  write_done
+    output logic                  write_done,
+
+    output logic                  dcache_miss,
+    output logic                  dcache_refilling,
+    output logic                  dcache_mshr_busy,
+    output logic                  dcache_hit_under_miss,
+    output logic                  dcache_miss_under_miss,
+    output logic                  dcache_mshr_stall
 );
 
-    logic [63:0] mem_load_data;
+    logic [63:0] mem_load_data, fill_load_data;
+    logic [2:0]  fill_funct3;
+
+    function automatic logic [63:0] load_extend(input logic [2:0] funct3, input logic [63:0] data);
+        case (funct3)
+            3'b100:  return { 56'd0, data[7:0] };  // LBU
+            3'b101:  return { 48'd0, data[15:0] }; // LHU
+            3'b110:  return { 32'd0, data[31:0] }; // LWU
+            default: return data;
+        endcase
+    endfunction
 
     always_comb begin
 
         if (decoded_inst_in.mem_read) begin
-            case (decoded_inst_in.funct3)
-                3'b100: mem_data_out = { 56'd0, mem_load_data[7:0] };  // LBU
-                3'b101: mem_data_out = { 48'd0, mem_load_data[15:0] }; // LHU
-                3'b110: mem_data_out = { 32'd0, mem_load_data[31:0] }; // LWU
-                default: mem_data_out = mem_load_data;
-            endcase
+            mem_data_out = load_extend(decoded_inst_in.funct3, mem_load_data);
         end
     end
 
+    assign fill_data = load_extend(fill_funct3, fill_load_data);
+
     DCache #(
         .ADDR_WIDTH(ADDR_WIDTH),
         .DATA_WIDTH(DATA_WIDTH),
         .CACHE_LINE_SIZE(512), 
-        .NUMBER_OF_SETS(512),
+        .NUMBER_OF_SETS(DCACHE_SETS),
         .NUMBER_OF_WAYS(2),
-        .ID_WIDTH(ID_WIDTH)
+        .ID_WIDTH(ID_WIDTH),
+        .NUM_MSHRS(NUM_MSHRS)
     ) dcache_inst (
         .clk(clk),
         .reset(reset),
@@ -238,6 +350,18 @@ module MemStage #(
         .read_data_out(mem_load_data),
         .read_valid_out(read_done),
         .write_valid_out(write_done),
+
+        .rd_in(decoded_inst_in.rd),
+        .funct3_in(decoded_inst_in.funct3),
+        .hold(hold),
+        .wb_enable_in(wb_enable_in),
+        .wb_rd_in(wb_rd_in),
+        .pending_out(load_pending),
+        .fill_valid_out(fill_enable),
+        .fill_rd_out(fill_rd),
+        .fill_funct3_out(fill_funct3),
+        .fill_data_out(fill_load_data),
+        .pending_regs_out(pending_regs),
         
         .m_axi_arid(dcache_arid),
         .m_axi_araddr(dcache_araddr),
@@ -282,11 +406,23 @@ module MemStage #(
         .m_axi_acvalid(m_axi_acvalid),
         .m_axi_acready(m_axi_acready),
         .m_axi_acaddr(m_axi_acaddr),
-        .m_axi_acsnoop(m_axi_acsnoop)
+        .m_axi_acsnoop(m_axi_acsnoop),
+
+        .miss_out(dcache_miss),
+        .refilling_out(dcache_refilling),
+        .mshr_busy_out(dcache_mshr_busy),
+        .hit_under_miss_out(dcache_hit_under_miss),
+        .miss_under_miss_out(dcache_miss_under_miss),
+        .mshr_stall_out(dcache_mshr_stall)
     );
     
     assign alu_result_out   = alu_result_in;
-    assign decoded_inst_out = decoded_inst_in;
+
+    always_comb begin
+        decoded_inst_out = decoded_inst_in;
+        // the refill writes the register, not WB
+        if (load_pending) decoded_inst_out.reg_write = 1'b0;
+    end
 
     
 endmodule
@@ -396,7 +532,19 @@ module top #(
     parameter ID_WIDTH    = 13,
     parameter ADDR_WIDTH  = 64,
     parameter DATA_WIDTH  = 64,
-    parameter STRB_WIDTH  = DATA_WIDTH / 8
+    parameter STRB_WIDTH  = DATA_WIDTH / 8,
+    // sets of 2 x 64-byte lines, a power of two; set per build with ICACHE_SETS=/DCACHE_SETS= in the Makefile
+    parameter ICACHE_SETS = 512,
+    parameter DCACHE_SETS = 512,
+    // bypass EX/MEM and MEM/WB results into EX, so only load-use hazards stall (FORWARDING= in the Makefile)
+    parameter FORWARDING  = 1,
+    // branch predictor (BP_*= in the Makefile): 0 always not taken, 1 bimodal, 2 gshare
+    parameter BP_MODE     = 2,
+    parameter BP_PHT_BITS = 12,
+    parameter BP_BTB_BITS = 9,
+    parameter BP_RAS_BITS = 3,
+    // DCache load misses outstanding while the pipeline carries on (NUM_MSHRS= in the Makefile)
+    parameter NUM_MSHRS   = 2
 ) (
     input  logic                    clk,
     input  logic                    reset,
@@ -405,6 +553,9 @@ module top #(
     input  logic [63:0]             entry,
     input  logic [63:0]             stackptr,
     input  logic [63:0]             satp,
+    output logic [63:0]             instret,
+    output logic                    mem_blocked,
+    input  logic [63:0]             skipped,   // cycles the harness skipped since the last rising edge
 
     
     output logic [ID_WIDTH-1:0]     m_axi_awid,
@@ -493,6 +644,21 @@ module top #(
     logic               mem_wb_flush_out;
 
     logic               enable_pc;
+    logic               waiting_read;
+
+    logic               mispredict;    // the branch or jalr in EX does not continue where fetch went
+    logic [63:0]        redirect_pc;
+    logic               ex_redirect;   // and fetch is redirected as it moves on
+    logic               id_jump;       // the jal in decode was not predicted
+    logic [63:0]        jump_target;
+    logic               id_redirect;   // and fetch is redirected as it moves on
+    logic               resolving;     // the instruction in EX moves on this cycle
+    packed_inst         resolve_inst;  // and trains the predictor, or zero
+    logic               resolve_taken;
+    logic [63:0]        resolve_target;
+    logic               recover;       // younger instructions are flushed: ECALL or mispredict
+    packed_inst         recover_inst;
+    logic               arbiter_conflict;
 
     Arbiter #(
         .ID_WIDTH(ID_WIDTH),
@@ -535,7 +701,10 @@ module top #(
         .m_axi_rresp(m_axi_rresp),
         .m_axi_rlast(m_axi_rlast),
         .m_axi_rvalid(m_axi_rvalid),
-        .m_axi_rready(m_axi_rready)
+        .m_axi_rready(m_axi_rready),
+
+        .waiting_read(waiting_read),
+        .conflict(arbiter_conflict)
     );
 
 
@@ -545,12 +714,20 @@ module top #(
     logic                  icache_valid_if;
     logic [31:0]           instruction_out_if;
     logic [63:0]           pc_out_if;
+    logic                  icache_miss, icache_refilling;
+    logic [63:0]           next_pc_if;
+    branch_pred_t          pred_if;
 
     IFStage #(
         .ID_WIDTH(ID_WIDTH),
         .ADDR_WIDTH(ADDR_WIDTH),
         .DATA_WIDTH(DATA_WIDTH),
-        .STRB_WIDTH(STRB_WIDTH)
+        .STRB_WIDTH(STRB_WIDTH),
+        .ICACHE_SETS(ICACHE_SETS),
+        .BP_MODE(BP_MODE),
+        .BP_PHT_BITS(BP_PHT_BITS),
+        .BP_BTB_BITS(BP_BTB_BITS),
+        .BP_RAS_BITS(BP_RAS_BITS)
     ) if_stage_inst (
         .clk(clk),
         .reset(reset),
@@ -559,6 +736,15 @@ module top #(
         .pc_out(pc_out_if),
         .instruction_out(instruction_out_if),
 
+        .fetch(enable_pc),
+        .next_pc_out(next_pc_if),
+        .pred_out(pred_if),
+        .resolve_inst(resolve_inst),
+        .resolve_taken(resolve_taken),
+        .resolve_target(resolve_target),
+        .recover(recover),
+        .recover_inst(recover_inst),
+
         .m_axi_arid(icache_arid),
         .m_axi_araddr(icache_araddr),
         .m_axi_arlen(icache_arlen),
@@ -578,12 +764,16 @@ module top #(
         .m_axi_rready(icache_rready),
 
         .flush(flush_if_id), 
-        .branch_taken(branch_taken_delay)
+        .branch_taken(branch_taken_delay),
+
+        .icache_miss(icache_miss),
+        .icache_refilling(icache_refilling)
     );
 
     logic                   icache_valid_if_id;
     logic [63:0]            pc_out_if_id;
     logic [31:0]            instruction_out_if_id;
+    branch_pred_t           pred_if_id;
     
 
     IF_ID if_id_inst (
@@ -597,7 +787,9 @@ module top #(
         .instruction_in(instruction_out_if),
         .instruction_out(instruction_out_if_id),
         .icache_valid_in(icache_valid_if),
-        .icache_valid_out(icache_valid_if_id)
+        .icache_valid_out(icache_valid_if_id),
+        .pred_in(pred_if),
+        .pred_out(pred_if_id)
     );
 
 
@@ -607,6 +799,7 @@ module top #(
     Decode decoder_inst (
         .addr(pc_out_if_id),
         .instr(instruction_out_if_id),
+        .pred(pred_if_id),
         .out_instr(if_id_decoded_inst),
         .out_str(decoded_str)
     );
@@ -626,7 +819,9 @@ module top #(
         .clk(clk),
         .reset(reset),
         .decoded_inst_in(if_id_decoded_inst),
-        .decoded_inst_out(decoded_inst_id_out)
+        .decoded_inst_out(decoded_inst_id_out),
+        .jump_out(id_jump),
+        .jump_target_out(jump_target)
     );
 
 
@@ -636,6 +831,8 @@ module top #(
     logic [63:0] debug_3_id_ex_pc = id_ex_decoded_inst.addr;
     logic [63:0]           rs1_data_ex;
     logic [63:0]           rs2_data_ex;
+    logic [63:0]           rs1_fwd_ex;
+    logic [63:0]           rs2_fwd_ex;
 
     ID_EX id_ex_inst (
         .clk(clk),
@@ -646,12 +843,17 @@ module top #(
         .decoded_inst_in(decoded_inst_id_out),
         .rs1_data_in(rs1_data_id),
         .rs2_data_in(rs2_data_id),
+        .rs1_hold_in(rs1_fwd_ex),
+        .rs2_hold_in(rs2_fwd_ex),
         .decoded_inst_out(id_ex_decoded_inst),
         .rs1_data_out(rs1_data_ex),
         .rs2_data_out(rs2_data_ex)
     );
 
     logic [63:0]           a0, a1, a2, a3, a4, a5, a6, a7; // for ecall
+    logic                  fill_enable;                    // a load that missed gets its data
+    logic [4:0]            fill_rd;
+    logic [63:0]           fill_data;
 
     Regfile regfile_inst (
         .clk(clk),
@@ -665,6 +867,9 @@ module top #(
         .rd(wb_rd),                    
         .rd_data(wb_data),             
         .write_enable(wb_enable),      
+        .fill_rd(fill_rd),
+        .fill_data(fill_data),
+        .fill_enable(fill_enable),
         .a0(a0), .a1(a1), .a2(a2), .a3(a3), .a4(a4), .a5(a5), .a6(a6), .a7(a7) // ecall
     );
 
@@ -677,12 +882,22 @@ module top #(
     logic                  branch_taken_ex;
     logic [63:0]           branch_target_ex;
 
-    EXStage ex_stage (
+    EXStage #(
+        .FORWARDING(FORWARDING)
+    ) ex_stage (
         .clk(clk),
         .reset(reset),
         .decoded_inst_in(id_ex_decoded_inst),
         .rs1_data_in(rs1_data_ex), 
         .rs2_data_in(rs2_data_ex),
+        .ex_mem_inst_in(ex_mem_decoded_inst),
+        .ex_mem_flush_in(ex_mem_flush_out),
+        .ex_mem_result_in(ex_mem_alu_result),
+        .wb_enable_in(wb_enable),
+        .wb_rd_in(wb_rd),
+        .wb_data_in(wb_data),
+        .rs1_fwd_out(rs1_fwd_ex),
+        .rs2_fwd_out(rs2_fwd_ex),
         .alu_result_out(alu_result_ex),
         .decoded_inst_out(decoded_inst_ex_out),
         .store_data_out(rs2_data_ex_out),
@@ -691,6 +906,17 @@ module top #(
         .branch_target_out(branch_target_ex)
     );
 
+    // a taken instruction fetch did not follow, or a not-taken one it did, or to the wrong target
+    assign mispredict  = branch_taken_ex ? !id_ex_decoded_inst.pred.taken || id_ex_decoded_inst.pred.target != branch_target_ex
+                                         : id_ex_decoded_inst.pred.taken;
+    assign redirect_pc = branch_taken_ex ? branch_target_ex : id_ex_decoded_inst.addr + 64'd4;
+
+    // an ECALL in WB flushes it instead, and the pipeline restarts after the ECALL
+    assign resolving      = !id_ex_flush_out && enable_ex_mem && !ecall_stall;
+    assign resolve_inst   = resolving ? id_ex_decoded_inst : '0;
+    assign resolve_taken  = branch_taken_ex;
+    assign resolve_target = branch_target_ex;
+
 
     logic [63:0] ex_mem_alu_result;
     logic [63:0] ex_mem_store_data_out;
@@ -724,12 +950,18 @@ module top #(
     logic [DATA_WIDTH-1:0]    alu_result_mem;   
     packed_inst            decoded_inst_mem_out;
     logic [63:0] debug_6_mem_pc = decoded_inst_mem_out.addr;
+    logic                     dcache_miss, dcache_refilling;
+    logic                     load_pending;
+    logic [31:0]              pending_regs;
+    logic                     dcache_mshr_busy, dcache_hit_under_miss, dcache_miss_under_miss, dcache_mshr_stall;
 
 
     MemStage #(
         .ADDR_WIDTH(ADDR_WIDTH),
         .DATA_WIDTH(DATA_WIDTH),
-        .ID_WIDTH(ID_WIDTH)
+        .ID_WIDTH(ID_WIDTH),
+        .DCACHE_SETS(DCACHE_SETS),
+        .NUM_MSHRS(NUM_MSHRS)
     ) mem_stage_inst (
         .clk(clk),
         .reset(reset),
@@ -738,6 +970,15 @@ module top #(
         .store_data_in(ex_mem_store_data_out), 
         .decoded_inst_in(ex_mem_decoded_inst),
         .flush_ex_mem(ex_mem_flush_out),
+        .hold(ecall_stall),
+
+        .wb_enable_in(wb_enable),
+        .wb_rd_in(wb_rd),
+        .load_pending(load_pending),
+        .fill_enable(fill_enable),
+        .fill_rd(fill_rd),
+        .fill_data(fill_data),
+        .pending_regs(pending_regs),
 
         .mem_data_out(mem_data_mem),
         .alu_result_out(alu_result_mem),
@@ -784,6 +1025,13 @@ module top #(
         .read_done(read_done),
         .write_done(write_done),
 
+        .dcache_miss(dcache_miss),
+        .dcache_refilling(dcache_refilling),
+        .dcache_mshr_busy(dcache_mshr_busy),
+        .dcache_hit_under_miss(dcache_hit_under_miss),
+        .dcache_miss_under_miss(dcache_miss_under_miss),
+        .dcache_mshr_stall(dcache_mshr_stall),
+
         .m_axi_acvalid(m_axi_acvalid),
         .m_axi_acready(m_axi_acready),
         .m_axi_acaddr(m_axi_acaddr),
@@ -849,7 +1097,12 @@ module top #(
     );
 
 
-    ControlUnit control (
+    logic load_stall, store_stall, raw_id_ex, raw_ex_mem, raw_mem_wb, pending_stall;
+    stall_cause_t flush_cause_if_id, flush_cause_id_ex, flush_cause_ex_mem, flush_cause_mem_wb;
+
+    ControlUnit #(
+        .FORWARDING(FORWARDING)
+    ) control (
 
         .if_id_inst(if_id_decoded_inst),
         .id_ex_inst(id_ex_decoded_inst),
@@ -864,9 +1117,16 @@ module top #(
         .read_done(read_done),
         .write_done(write_done),
         .icache_valid_if(icache_valid_if),
+
+        .pending_regs(pending_regs),
+        .load_pending(load_pending),
+        .mshr_busy(dcache_mshr_busy),
         
         .ecall_stall(ecall_stall),
-        .mem_branch_taken(ex_mem_branch_taken),
+        .ex_mispredict(mispredict),
+        .id_jump(id_jump),
+        .ex_redirect(ex_redirect),
+        .id_redirect(id_redirect),
 
         .flush_if_id(flush_if_id),
         .flush_id_ex(flush_id_ex),
@@ -877,9 +1137,122 @@ module top #(
         .enable_id_ex(enable_id_ex),
         .enable_ex_mem(enable_ex_mem),
         .enable_mem_wb(enable_mem_wb),
-        .enable_pc(enable_pc)
+        .enable_pc(enable_pc),
+
+        .load_stall(load_stall),
+        .store_stall(store_stall),
+        .raw_id_ex(raw_id_ex),
+        .raw_ex_mem(raw_ex_mem),
+        .raw_mem_wb(raw_mem_wb),
+        .pending_stall(pending_stall),
+
+        .flush_cause_if_id(flush_cause_if_id),
+        .flush_cause_id_ex(flush_cause_id_ex),
+        .flush_cause_ex_mem(flush_cause_ex_mem),
+        .flush_cause_mem_wb(flush_cause_mem_wb)
+    );
+
+
+    logic retiring;
+    assign retiring = !mem_wb_flush_out && mem_wb_decoded_inst.opcode != '0 && !ecall_stall;
+
+    assign recover      = ecall_stall || ex_redirect;
+    assign recover_inst = ecall_stall ? mem_wb_decoded_inst : id_ex_decoded_inst;
+
+    // retired instruction count, read by the harness for KIPS reporting
+    always_ff @(posedge clk or posedge reset) begin
+        if (reset) begin
+            instret <= '0;
+        end else if (retiring) begin
+            instret <= instret + 64'd1;
+        end
+    end
+
+    // A fetch or data access that missed completes once its line is in; that replay is not a hit.
+    // A load that takes an MSHR completes as it misses.
+    logic icache_replay, dcache_replay, dcache_done;
+    assign dcache_done = !ex_mem_flush_out && ((ex_mem_decoded_inst.mem_read && read_done)
+                                               || (ex_mem_decoded_inst.mem_write && write_done));
+
+    always_ff @(posedge clk or posedge reset) begin
+        if (reset) begin
+            icache_replay <= 1'b0;
+            dcache_replay <= 1'b0;
+        end else begin
+            if (icache_miss) icache_replay <= 1'b1;
+            else if (enable_pc) icache_replay <= 1'b0;
+            if (dcache_miss && !load_pending) dcache_replay <= 1'b1;
+            else if (dcache_done) dcache_replay <= 1'b0;
+        end
+    end
+
+    // CPI stack: every pipeline register carries the cause of the bubble it holds (BASE for an
+    // instruction, ICACHE for a fetch that missed), and writeback charges each cycle to one cause
+    stall_cause_t if_id_cause, id_ex_cause, ex_mem_cause, mem_wb_cause, cpi_cause;
+
+    always_ff @(posedge clk or posedge reset) begin
+        if (reset) begin
+            if_id_cause  <= CAUSE_BASE;
+            id_ex_cause  <= CAUSE_BASE;
+            ex_mem_cause <= CAUSE_BASE;
+            mem_wb_cause <= CAUSE_BASE;
+        end else begin
+            if (enable_if_id)  if_id_cause  <= flush_if_id  ? flush_cause_if_id  : icache_valid_if ? CAUSE_BASE : CAUSE_ICACHE;
+            if (enable_id_ex)  id_ex_cause  <= flush_id_ex  ? flush_cause_id_ex  : if_id_cause;
+            if (enable_ex_mem) ex_mem_cause <= flush_ex_mem ? flush_cause_ex_mem : id_ex_cause;
+            if (enable_mem_wb) mem_wb_cause <= flush_mem_wb ? flush_cause_mem_wb : ex_mem_cause;
+        end
+    end
+
+    assign cpi_cause = retiring ? CAUSE_BASE : ecall_stall ? CAUSE_ECALL : mem_wb_cause;
+
+    PerfCounters perf_counters (
+        .clk(clk),
+        .reset(reset),
+        .skipped(skipped),
+        .retired(retiring),
+        .icache_hit(enable_pc && !icache_replay),
+        .icache_miss(icache_miss),
+        .icache_refilling(icache_refilling),
+        .dcache_hit(dcache_done && !dcache_replay && !load_pending),
+        .dcache_miss(dcache_miss),
+        .dcache_refilling(dcache_refilling),
+        .load_stall(load_stall),
+        .store_stall(store_stall),
+        .raw_id_ex(raw_id_ex),
+        .raw_ex_mem(raw_ex_mem),
+        .raw_mem_wb(raw_mem_wb),
+        .ecall_stall(ecall_stall),
+        .branch_flush(ex_redirect),
+        .jump_redirect(id_redirect),
+        .branch_resolved(resolve_inst.opcode == 7'b1100011),
+        .jump_resolved(resolve_inst.opcode == 7'b1101111 || resolve_inst.opcode == 7'b1100111),
+        .arbiter_conflict(arbiter_conflict),
+        .pending_stall(pending_stall),
+        .mshr_busy(dcache_mshr_busy),
+        .mshr_stall(dcache_mshr_stall),
+        .hit_under_miss(dcache_hit_under_miss),
+        .miss_under_miss(dcache_miss_under_miss),
+        .cpi_cause(cpi_cause)
     );
 
+    // The core is waiting on read data and has made no progress for MEM_BLOCKED_SETTLE cycles,
+    // long enough for every stage to drain or hold: until the next R beat arrives no state
+    // changes, so the harness may skip cycles without evaluating the model (SKIP_STALLS=y).
+    localparam MEM_BLOCKED_SETTLE = 8;
+    logic [3:0] blocked_cycles;
+    assign mem_blocked = blocked_cycles == MEM_BLOCKED_SETTLE;
+
+    always_ff @(posedge clk or posedge reset) begin
+        if (reset) begin
+            blocked_cycles <= '0;
+        end else if (!waiting_read || enable_pc || ecall_stall || mem_wb_decoded_inst.ecall_flag || ex_redirect || id_redirect
+                     || retiring) begin
+            blocked_cycles <= '0;
+        end else if (!mem_blocked) begin
+            blocked_cycles <= blocked_cycles + 4'd1;
+        end
+    end
 
     always_ff @(posedge clk or posedge reset) begin
         if (reset) begin
@@ -887,15 +1260,17 @@ module top #(
             pc <= entry;
             //$display("Initializing top, entry point = 0x%h", entry);
         end else if (enable_pc) begin
-            pc <= pc + 64'd4;
+            pc <= next_pc_if;
             //$display("Top: Updating PC to 0x%h", pc + 64'd4);
         end else if (mem_wb_decoded_inst.ecall_flag) begin 
             pc <= mem_wb_decoded_inst.addr + 64'd4;
             //$display("Top: ECALL - PC kept at 0x%h.", mem_wb_decoded_inst.addr + 64'd4);
-        end else if (ex_mem_branch_taken) begin 
-            pc <= ex_mem_branch_target;
+        end else if (ex_redirect) begin 
+            pc <= redirect_pc;
             //if (ex_mem_branch_target == entry) $finish;
             //$display("Top: Branch taken. Updating PC to 0x%h", branch_target_ex);
+        end else if (id_redirect) begin
+            pc <= jump_target;
         end else begin
             pc <= pc;
             //$display("Top: Stalling PC to 0x%h", pc);
@@ -1,6 +1,14 @@
 `ifndef TYPES_SV
 `define TYPES_SV
 
+// what fetch predicted for an instruction (branch_predictor.sv), checked when it resolves in EX
+typedef struct packed {
+    logic        taken;      // fetch continued at target instead of addr+4
+    logic [63:0] target;
+    logic [15:0] index;      // direction counter it was predicted with
+    logic [7:0]  ras_ptr;    // return stack top after this instruction's push or pop
+} branch_pred_t;
+
 // structure for a decoded instruction
 typedef struct packed {
     logic [31:0] pc;
@@ -22,6 +30,21 @@ typedef struct packed {
     logic branch_taken;
     logic ecall_flag;
     logic load_unsigned;
+    branch_pred_t pred;
 } packed_inst;
 
+// What a pipeline bubble stands for.  Each cycle is charged to one of these when it reaches
+// writeback: BASE when an instruction retires, otherwise the cause of the bubble there.
+typedef enum logic [3:0] {
+    CAUSE_BASE,
+    CAUSE_ICACHE,       // fetch missed
+    CAUSE_LOAD,         // DCache load miss
+    CAUSE_STORE,        // DCache store miss
+    CAUSE_RAW_ID_EX,    // RAW hazard on the instruction in ID/EX
+    CAUSE_RAW_EX_MEM,
+    CAUSE_RAW_MEM_WB,
+    CAUSE_BRANCH,       // taken-branch flush
+    CAUSE_ECALL
+} stall_cause_t;
+
 `endif 
\ No newline at end of file